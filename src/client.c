@@ -41,6 +41,9 @@
 #define TMBR_ARG_KEY    (1 << 4)
 #define TMBR_ARG_CMD    (1 << 5)
 #define TMBR_ARG_MODE   (1 << 6)
+#define TMBR_ARG_CONFIG (1 << 7)
+#define TMBR_ARG_SOURCE (1 << 8)
+#define TMBR_ARG_LAYOUT (1 << 9)
 
 static const struct {
 	const char *cmd;
@@ -48,24 +51,32 @@ static const struct {
 	int function;
 	int args;
 } commands[] = {
-	{ "client", "focus",      TMBR_CTRL_CLIENT_FOCUS,      TMBR_ARG_SEL                  },
-	{ "client", "fullscreen", TMBR_CTRL_CLIENT_FULLSCREEN, 0                             },
-	{ "client", "kill",       TMBR_CTRL_CLIENT_KILL,       0                             },
-	{ "client", "resize",     TMBR_CTRL_CLIENT_RESIZE,     TMBR_ARG_DIR|TMBR_ARG_INT     },
-	{ "client", "swap",       TMBR_CTRL_CLIENT_SWAP,       TMBR_ARG_SEL                  },
-	{ "client", "to_desktop", TMBR_CTRL_CLIENT_TO_DESKTOP, TMBR_ARG_SEL                  },
-	{ "client", "to_screen",  TMBR_CTRL_CLIENT_TO_SCREEN,  TMBR_ARG_SEL                  },
-	{ "desktop", "focus",     TMBR_CTRL_DESKTOP_FOCUS,     TMBR_ARG_SEL                  },
-	{ "desktop", "kill",      TMBR_CTRL_DESKTOP_KILL,      0                             },
-	{ "desktop", "new",       TMBR_CTRL_DESKTOP_NEW,       0                             },
-	{ "desktop", "swap",      TMBR_CTRL_DESKTOP_SWAP,      TMBR_ARG_SEL                  },
-	{ "screen", "focus",      TMBR_CTRL_SCREEN_FOCUS,      TMBR_ARG_SEL                  },
-	{ "screen", "scale",      TMBR_CTRL_SCREEN_SCALE,      TMBR_ARG_SCREEN|TMBR_ARG_INT  },
-	{ "screen", "mode",       TMBR_CTRL_SCREEN_MODE,       TMBR_ARG_SCREEN|TMBR_ARG_MODE },
-	{ "tree", "rotate",       TMBR_CTRL_TREE_ROTATE,       0                             },
-	{ "state", "query",       TMBR_CTRL_STATE_QUERY,       0                             },
-	{ "state", "quit",        TMBR_CTRL_STATE_QUIT,        0                             },
-	{ "binding", "add",       TMBR_CTRL_BINDING_ADD,       TMBR_ARG_KEY|TMBR_ARG_CMD     }
+	{ "client", "focus",      TMBR_CTRL_CLIENT_FOCUS,      TMBR_ARG_SEL                    },
+	{ "client", "fullscreen", TMBR_CTRL_CLIENT_FULLSCREEN, 0                               },
+	{ "client", "kill",       TMBR_CTRL_CLIENT_KILL,       0                               },
+	{ "client", "resize",     TMBR_CTRL_CLIENT_RESIZE,     TMBR_ARG_DIR|TMBR_ARG_INT       },
+	{ "client", "swap",       TMBR_CTRL_CLIENT_SWAP,       TMBR_ARG_SEL                    },
+	{ "client", "to_desktop", TMBR_CTRL_CLIENT_TO_DESKTOP, TMBR_ARG_SEL                    },
+	{ "client", "to_screen",  TMBR_CTRL_CLIENT_TO_SCREEN,  TMBR_ARG_SEL                    },
+	{ "desktop", "focus",     TMBR_CTRL_DESKTOP_FOCUS,     TMBR_ARG_SEL                    },
+	{ "desktop", "kill",      TMBR_CTRL_DESKTOP_KILL,      0                               },
+	{ "desktop", "new",       TMBR_CTRL_DESKTOP_NEW,       0                               },
+	{ "desktop", "swap",      TMBR_CTRL_DESKTOP_SWAP,      TMBR_ARG_SEL                    },
+	{ "desktop", "overview",  TMBR_CTRL_DESKTOP_OVERVIEW,  0                               },
+	{ "screen", "focus",      TMBR_CTRL_SCREEN_FOCUS,      TMBR_ARG_SEL                    },
+	{ "screen", "scale",      TMBR_CTRL_SCREEN_SCALE,      TMBR_ARG_SCREEN|TMBR_ARG_INT    },
+	{ "screen", "mode",       TMBR_CTRL_SCREEN_MODE,       TMBR_ARG_SCREEN|TMBR_ARG_MODE   },
+	{ "screen", "configure",  TMBR_CTRL_SCREEN_CONFIGURE,  TMBR_ARG_CONFIG                 },
+	{ "screen", "new",        TMBR_CTRL_SCREEN_NEW,        TMBR_ARG_MODE                   },
+	{ "screen", "kill",       TMBR_CTRL_SCREEN_KILL,       TMBR_ARG_SCREEN                 },
+	{ "screen", "mirror",     TMBR_CTRL_SCREEN_MIRROR,     TMBR_ARG_SCREEN|TMBR_ARG_SOURCE },
+	{ "screen", "unmirror",   TMBR_CTRL_SCREEN_MIRROR,     TMBR_ARG_SCREEN                 },
+	{ "tree", "rotate",       TMBR_CTRL_TREE_ROTATE,       0                               },
+	{ "tree", "export",       TMBR_CTRL_TREE_EXPORT,       0                               },
+	{ "tree", "import",       TMBR_CTRL_TREE_IMPORT,       TMBR_ARG_LAYOUT                 },
+	{ "state", "query",       TMBR_CTRL_STATE_QUERY,       0                               },
+	{ "state", "quit",        TMBR_CTRL_STATE_QUIT,        0                               },
+	{ "binding", "add",       TMBR_CTRL_BINDING_ADD,       TMBR_ARG_KEY|TMBR_ARG_CMD       }
 };
 
 struct tmbr_arg {
@@ -76,7 +87,11 @@ struct tmbr_arg {
 	struct { uint32_t modifiers; xkb_keysym_t keycode; } key;
 	struct { int height; int width; int refresh; } mode;
 	const char *command;
+	const char *layout;
 	const char *screen;
+	const char *source;
+	struct { const char *screen; int enabled, width, height, refresh, scale, x, y; } *configs;
+	int nconfigs;
 };
 
 static const struct {
@@ -99,6 +114,7 @@ static const char *selections[] = { "prev", "next" };
 static void tmbr_parse(struct tmbr_arg *out, int argc, char **argv)
 {
 	ssize_t c, i;
+	int n;
 
 	if (argc < 1)
 		die("Missing command");
@@ -121,6 +137,14 @@ static void tmbr_parse(struct tmbr_arg *out, int argc, char **argv)
 		argv++;
 	}
 
+	if (commands[c].args & TMBR_ARG_SOURCE) {
+		if (!argc)
+			die("Command is missing source screen");
+		out->source = argv[0];
+		argc--;
+		argv++;
+	}
+
 	if (commands[c].args & TMBR_ARG_SEL) {
 		if (!argc)
 			die("Command is missing selection");
@@ -182,15 +206,43 @@ static void tmbr_parse(struct tmbr_arg *out, int argc, char **argv)
 		argv++;
 	}
 
+	if (commands[c].args & TMBR_ARG_LAYOUT) {
+		if (!argc)
+			die("Command is missing layout");
+		out->layout = argv[0];
+		argc--;
+		argv++;
+	}
+
 	if (commands[c].args & TMBR_ARG_MODE) {
 		if (!argc)
 			die("Command is missing mode");
-		if (sscanf(argv[0], "%dx%d@%d", &out->mode.width, &out->mode.height, &out->mode.refresh) != 3)
+		if (sscanf(argv[0], "%dx%d@%d%n", &out->mode.width, &out->mode.height, &out->mode.refresh, &n) != 3 || argv[0][n])
 			die("Invalid mode '%s'", argv[0]);
 		argc--;
 		argv++;
 	}
 
+	if (commands[c].args & TMBR_ARG_CONFIG) {
+		if (!argc)
+			die("Command is missing screen configuration");
+		out->configs = tmbr_alloc(argc * sizeof(*out->configs), "Could not allocate screen configuration");
+		for (; argc; argc--, argv++, out->nconfigs++) {
+			char *cfg = strrchr(argv[0], ':');
+			if (!cfg)
+				die("Invalid screen configuration '%s'", argv[0]);
+			*cfg++ = '\0';
+			out->configs[out->nconfigs].screen = argv[0];
+			if (!strcmp(cfg, "off"))
+				continue;
+			if (sscanf(cfg, "%dx%d@%d,%d,%d,%d%n", &out->configs[out->nconfigs].width, &out->configs[out->nconfigs].height,
+				   &out->configs[out->nconfigs].refresh, &out->configs[out->nconfigs].scale,
+				   &out->configs[out->nconfigs].x, &out->configs[out->nconfigs].y, &n) != 6 || cfg[n])
+				die("Invalid screen configuration '%s'", cfg);
+			out->configs[out->nconfigs].enabled = 1;
+		}
+	}
+
 	if (argc)
 		die("Command has trailing arguments");
 }
@@ -211,16 +263,19 @@ static void __attribute__((noreturn)) usage(const char *executable)
 
 	puts("These are the availabe commands:\n");
 
-	printf("   %s run\n", executable);
+	printf("   %s run [--profile] [--realtime]\n", executable);
 	for (i = 0; i < ARRAY_SIZE(commands); i++)
-		printf("   %s %s %s%s%s%s%s%s%s%s\n", executable, commands[i].cmd, commands[i].subcmd,
+		printf("   %s %s %s%s%s%s%s%s%s%s%s%s%s\n", executable, commands[i].cmd, commands[i].subcmd,
 			commands[i].args & TMBR_ARG_SCREEN ? " <SCREEN>" : "",
+			commands[i].args & TMBR_ARG_SOURCE ? " <SOURCE>" : "",
 			commands[i].args & TMBR_ARG_SEL ? " (next|prev)" : "",
 			commands[i].args & TMBR_ARG_DIR ? " (north|south|east|west)" : "",
 			commands[i].args & TMBR_ARG_INT ? " <NUMBER>" : "",
 			commands[i].args & TMBR_ARG_KEY ? " <KEY>" : "",
 			commands[i].args & TMBR_ARG_CMD ? " <COMMAND>" : "",
-			commands[i].args & TMBR_ARG_MODE ? " <WIDTH>x<HEIGHT>@<REFRESH>" : "");
+			commands[i].args & TMBR_ARG_LAYOUT ? " <LAYOUT>" : "",
+			commands[i].args & TMBR_ARG_MODE ? " <WIDTH>x<HEIGHT>@<REFRESH>" : "",
+			commands[i].args & TMBR_ARG_CONFIG ? " (<SCREEN>:off|<SCREEN>:<WIDTH>x<HEIGHT>@<REFRESH>,<SCALE>,<X>,<Y>)..." : "");
 
 	exit(0);
 }
@@ -269,10 +324,23 @@ int tmbr_client(int argc, char *argv[])
 		case TMBR_CTRL_DESKTOP_KILL: tmbr_ctrl_desktop_kill(ctrl); break;
 		case TMBR_CTRL_DESKTOP_NEW: tmbr_ctrl_desktop_new(ctrl); break;
 		case TMBR_CTRL_DESKTOP_SWAP: tmbr_ctrl_desktop_swap(ctrl, args.sel); break;
+		case TMBR_CTRL_DESKTOP_OVERVIEW: tmbr_ctrl_desktop_overview(ctrl); break;
 		case TMBR_CTRL_SCREEN_FOCUS: tmbr_ctrl_screen_focus(ctrl, args.sel); break;
 		case TMBR_CTRL_SCREEN_SCALE: tmbr_ctrl_screen_scale(ctrl, args.screen, args.i); break;
 		case TMBR_CTRL_SCREEN_MODE: tmbr_ctrl_screen_mode(ctrl, args.screen, args.mode.height, args.mode.width, args.mode.refresh); break;
+		case TMBR_CTRL_SCREEN_CONFIGURE:
+			for (int i = 0; i < args.nconfigs; i++)
+				tmbr_ctrl_screen_configure(ctrl, args.configs[i].screen, args.configs[i].enabled, args.configs[i].width,
+							   args.configs[i].height, args.configs[i].refresh, args.configs[i].scale,
+							   args.configs[i].x, args.configs[i].y);
+			tmbr_ctrl_screen_apply(ctrl);
+			break;
+		case TMBR_CTRL_SCREEN_NEW: tmbr_ctrl_screen_new(ctrl, args.mode.width, args.mode.height, args.mode.refresh); break;
+		case TMBR_CTRL_SCREEN_KILL: tmbr_ctrl_screen_kill(ctrl, args.screen); break;
+		case TMBR_CTRL_SCREEN_MIRROR: tmbr_ctrl_screen_mirror(ctrl, args.screen, args.source ? args.source : ""); break;
 		case TMBR_CTRL_TREE_ROTATE: tmbr_ctrl_tree_rotate(ctrl); break;
+		case TMBR_CTRL_TREE_EXPORT: tmbr_ctrl_tree_export(ctrl, STDOUT_FILENO); break;
+		case TMBR_CTRL_TREE_IMPORT: tmbr_ctrl_tree_import(ctrl, args.layout); break;
 		case TMBR_CTRL_STATE_QUERY: tmbr_ctrl_state_query(ctrl, STDOUT_FILENO); break;
 		case TMBR_CTRL_STATE_QUIT: tmbr_ctrl_state_quit(ctrl); break;
 		case TMBR_CTRL_BINDING_ADD: tmbr_ctrl_binding_add(ctrl, args.key.keycode, args.key.modifiers, args.command); break;
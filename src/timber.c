@@ -21,7 +21,7 @@
 
 int main(int argc, char *argv[])
 {
-	if (argc == 2 && !strcmp(argv[1], "run"))
-		return tmbr_wm();
+	if (argc >= 2 && !strcmp(argv[1], "run"))
+		return tmbr_wm(argc - 2, argv + 2);
 	return tmbr_client(argc, argv);
 }
@@ -25,4 +25,4 @@
 void __attribute__((noreturn, format(printf, 1, 2))) die(const char *fmt, ...);
 void *tmbr_alloc(size_t bytes, const char *msg);
 int tmbr_client(int argc, char *argv[]);
-int tmbr_wm(void);
+int tmbr_wm(int argc, char *argv[]);
@@ -15,18 +15,35 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE /* pipe2 */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/input-event-codes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <wlr/config.h>
 #include <wlr/version.h>
 #include <wlr/backend.h>
+#include <wlr/backend/headless.h>
+#include <wlr/backend/multi.h>
+#include <wlr/render/dmabuf.h>
 #include <wlr/render/gles2.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_cursor.h>
 #include <wlr/types/wlr_data_device.h>
 #include <wlr/types/wlr_export_dmabuf_v1.h>
+#include <wlr/types/wlr_foreign_toplevel_management_v1.h>
 #include <wlr/types/wlr_gamma_control_v1.h>
 #if WLR_VERSION_MAJOR == 0 && WLR_VERSION_MINOR < 14
 # include <wlr/types/wlr_gtk_primary_selection.h>
@@ -39,6 +56,8 @@
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_output_damage.h>
 #include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_output_management_v1.h>
+#include <wlr/types/wlr_output_power_management_v1.h>
 #include <wlr/types/wlr_primary_selection.h>
 #include <wlr/types/wlr_primary_selection_v1.h>
 #include <wlr/types/wlr_server_decoration.h>
@@ -47,18 +66,47 @@
 #include <wlr/types/wlr_xdg_decoration_v1.h>
 #include <wlr/types/wlr_xdg_output_v1.h>
 #include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/edges.h>
 #include <wlr/util/log.h>
 #include <wlr/util/region.h>
+#include <wlr/xcursor.h>
+#if WLR_VERSION_MAJOR > 0 || WLR_VERSION_MINOR >= 12
+# include <drm_fourcc.h>
+#endif
+#if WLR_HAS_XWAYLAND
+# include <wlr/xwayland.h>
+# include <xcb/res.h>
+#endif
 
 #include "timber.h"
+#include "tearing-control-v1-protocol.h"
 #include "timber-protocol.h"
 
 #define tmbr_return_error(resource, code, msg) \
 	do { wl_resource_post_error((resource), (code), (msg)); return; } while (0)
+
 #define tmbr_box_scaled(vx, vy, vw, vh, s) (struct wlr_box){ .x = (vx)*(s), .y = (vy)*(s), .width = (vw)*(s), .height = (vh)*(s) }
 #define tmbr_box_from_pixman(b) (struct wlr_box) { .x = (b).x1, .y = (b).y1, .width = (b).x2 - (b).x1, .height = (b).y2 - (b).y1 }
 #define tmbr_box_to_pixman(b) (struct pixman_box32) { .x1 = (b).x, .x2 = (b).x + (b).width, .y1 = (b).y, .y2 = (b).y + (b).height }
 
+#ifndef SCHED_RESET_ON_FORK
+# define SCHED_RESET_ON_FORK 0x40000000
+#endif
+
+/*
+ * Buffers older than this always get fully damaged by wlr_output_damage, so
+ * the contents saved under the cursor of older frames are never needed.
+ */
+#define TMBR_SAVE_UNDER_FRAMES (WLR_OUTPUT_DAMAGE_PREVIOUS_LEN + 1)
+
+#if WLR_VERSION_MAJOR == 0 && WLR_VERSION_MINOR < 12
+# define TMBR_FORMAT_ABGR8888 WL_SHM_FORMAT_ABGR8888
+# define TMBR_FORMAT_XBGR8888 WL_SHM_FORMAT_XBGR8888
+#else
+# define TMBR_FORMAT_ABGR8888 DRM_FORMAT_ABGR8888
+# define TMBR_FORMAT_XBGR8888 DRM_FORMAT_XBGR8888
+#endif
+
 #if WLR_VERSION_MAJOR == 0 && WLR_VERSION_MINOR < 13
 # define WL_KEYBOARD_KEY_STATE_PRESSED WLR_KEY_PRESSED
 # define wlr_backend_autocreate(backend) wlr_backend_autocreate((backend), NULL)
@@ -90,6 +138,7 @@ struct tmbr_surface_render_data {
 	struct pixman_region32 *damage;
 	struct wlr_output *output;
 	struct wlr_box box;
+	float scale;
 };
 
 struct tmbr_surface_damage_data {
@@ -97,13 +146,24 @@ struct tmbr_surface_damage_data {
 	int x, y;
 };
 
+struct tmbr_process {
+	struct wl_list link;
+	pid_t pid;
+	int nice;
+	unsigned refs;
+};
+
 struct tmbr_xdg_client {
 	struct tmbr_server *server;
 	struct tmbr_desktop *desktop;
 	struct tmbr_tree *tree;
 	struct wlr_xdg_surface *surface;
+	struct wlr_xwayland_surface *xsurface;
+	struct wlr_foreign_toplevel_handle_v1 *toplevel_handle;
 	int h, w, x, y, border;
 	uint32_t pending_serial;
+	pid_t pid;
+	struct tmbr_process *process;
 
 	struct wl_event_source *configure_timer;
 	struct wl_listener map;
@@ -111,7 +171,13 @@ struct tmbr_xdg_client {
 	struct wl_listener destroy;
 	struct wl_listener commit;
 	struct wl_listener request_fullscreen;
+	struct wl_listener request_configure;
+	struct wl_listener set_title;
+	struct wl_listener set_app_id;
 	struct wl_listener new_popup;
+	struct wl_listener toplevel_activate;
+	struct wl_listener toplevel_close;
+	struct wl_listener toplevel_fullscreen;
 };
 
 struct tmbr_xdg_popup {
@@ -122,13 +188,53 @@ struct tmbr_xdg_popup {
 	struct wl_listener destroy;
 };
 
+#if WLR_HAS_XWAYLAND
+struct tmbr_xwayland_unmanaged {
+	struct tmbr_server *server;
+	struct wlr_xwayland_surface *surface;
+	struct wl_list link;
+	struct wl_listener map;
+	struct wl_listener unmap;
+	struct wl_listener destroy;
+	struct wl_listener commit;
+	struct wl_listener request_configure;
+};
+#endif
+
+#if WLR_HAS_XWAYLAND
+struct tmbr_xwayland_check {
+	struct tmbr_server *server;
+	struct wl_event_source *source;
+	pthread_t thread;
+	char display[16];
+	pid_t pid;
+	int clients;
+	int fds[2];
+};
+#endif
+
+struct tmbr_tearing_control {
+	struct wl_list link;
+	struct wl_resource *resource;
+	struct wlr_surface *surface;
+	enum wp_tearing_control_v1_presentation_hint pending, current;
+	struct wl_listener surface_commit;
+	struct wl_listener surface_destroy;
+};
+
+struct tmbr_xdg_decoration {
+	struct wlr_xdg_toplevel_decoration_v1 *decoration;
+	struct wl_listener request_mode;
+	struct wl_listener destroy;
+};
+
 struct tmbr_tree {
 	struct tmbr_tree *parent;
 	struct tmbr_tree *left;
 	struct tmbr_tree *right;
 	struct tmbr_xdg_client *client;
 	enum tmbr_split split;
-	uint8_t ratio;
+	float ratio;
 };
 
 struct tmbr_desktop {
@@ -137,6 +243,12 @@ struct tmbr_desktop {
 	struct tmbr_tree *clients;
 	struct tmbr_xdg_client *focus;
 	bool fullscreen;
+	bool resize_pending;
+
+	/* Downscaled snapshot of the desktop shown by the overview */
+	struct wlr_texture *thumbnail;
+	struct wlr_box thumbnail_box;
+	bool thumbnail_dirty;
 };
 
 struct tmbr_screen {
@@ -149,6 +261,49 @@ struct tmbr_screen {
 	struct wl_list desktops;
 	struct wl_list layer_clients;
 	struct tmbr_desktop *focus;
+	struct tmbr_screen *mirror;
+	bool disabled;
+	bool idle_disabled;
+	bool overview;
+
+	bool scanout;
+
+	/*
+	 * Regions reused across frames so that pixman can keep their
+	 * rectangle storage instead of reallocating it for every frame.
+	 */
+	struct pixman_region32 frame_damage;
+	struct pixman_region32 surface_damage;
+
+	/*
+	 * Contents underneath the software cursor for each of the last
+	 * frames, used to redraw frames where only the cursor moved. They
+	 * are only valid as long as no part of the scene got damaged.
+	 */
+	struct {
+		struct wlr_box box;
+		struct wlr_texture *texture;
+	} save_under[TMBR_SAVE_UNDER_FRAMES];
+	size_t save_under_frames, save_under_next, save_under_size;
+	uint32_t *save_under_pixels;
+	struct pixman_region32 cursor_damage;
+	bool scene_damaged;
+
+	/* Fallback for mirroring screens whose buffers cannot be exported */
+	struct {
+		bool enabled;
+		uint32_t *pixels;
+		size_t size;
+		uint32_t width, height;
+		uint64_t serial;
+		struct wlr_texture *texture;
+	} readback;
+
+	uint32_t input_stamp;
+	bool input_pending;
+	uint32_t latencies[256];
+	size_t nlatencies;
+	unsigned long frames, damage_reallocations;
 
 	struct wl_listener destroy;
 	struct wl_listener frame;
@@ -167,25 +322,67 @@ struct tmbr_layer_client {
 	struct wl_listener commit;
 };
 
+struct tmbr_xcursor_load {
+	struct wl_list link;
+	struct tmbr_server *server;
+	struct wlr_xcursor_theme *theme;
+	struct wl_event_source *source;
+	pthread_t thread;
+	float scale;
+	int fds[2];
+};
+
+struct tmbr_output_state {
+	struct wlr_output *output;
+	struct wlr_output_mode *mode;
+	int32_t width, height, refresh;
+	enum wl_output_transform transform;
+	float scale;
+	bool enabled;
+};
+
+struct tmbr_parked_screen {
+	struct tmbr_server *server;
+	struct wl_list link;
+	struct wl_list desktops;
+	struct tmbr_desktop *focus;
+	struct wl_event_source *timer;
+	char *name;
+};
+
 struct tmbr_server {
 	struct wl_display *display;
 	struct wlr_backend *backend;
+	struct wlr_backend *headless;
+	int32_t headless_refresh;
+	struct wlr_compositor *compositor;
 	struct wlr_cursor *cursor;
+	struct wlr_foreign_toplevel_manager_v1 *foreign_toplevel;
 	struct wlr_idle *idle;
 	struct wlr_idle_inhibit_manager_v1 *idle_inhibit;
 	struct wlr_idle_timeout *idle_timeout;
 	struct wlr_input_inhibit_manager *input_inhibit;
 	struct wlr_layer_shell_v1 *layer_shell;
 	struct wlr_output_layout *output_layout;
+	struct wlr_output_manager_v1 *output_manager;
+	struct wlr_output_power_manager_v1 *output_power;
 	struct wlr_seat *seat;
 	struct wlr_server_decoration_manager *decoration;
 	struct wlr_xcursor_manager *xcursor;
+	struct wlr_xdg_decoration_manager_v1 *xdg_decoration;
 	struct wlr_xdg_shell *xdg_shell;
+	struct wlr_xwayland *xwayland;
 
 	struct wl_listener new_input;
 	struct wl_listener new_output;
 	struct wl_listener new_surface;
 	struct wl_listener new_layer_shell_surface;
+	struct wl_listener new_xdg_decoration;
+	struct wl_listener new_xwayland_surface;
+	struct wl_listener output_layout_change;
+	struct wl_listener output_manager_apply;
+	struct wl_listener output_manager_test;
+	struct wl_listener output_power_set_mode;
 	struct wl_listener cursor_axis;
 	struct wl_listener cursor_button;
 	struct wl_listener cursor_motion;
@@ -204,7 +401,37 @@ struct tmbr_server {
 
 	struct wl_list bindings;
 	struct wl_list screens;
+	struct wl_list xcursor_loads;
+	struct wl_list parked_screens;
+	struct wl_list processes;
+	struct wl_list xwayland_unmanaged;
+	struct wl_list tearing_controls;
+	struct wl_event_source *xwayland_idle;
+	struct tmbr_xwayland_check *xwayland_check;
+	int xwayland_surfaces;
+	int cgroup_procs[2];
+	uint32_t input_stamp;
+	bool input_pending;
 	struct tmbr_screen *focussed_screen;
+	struct wl_event_source *output_configuration_idle;
+	struct wlr_output_configuration_v1 *ctrl_configuration;
+	struct wl_resource *ctrl_configuration_owner;
+
+	struct {
+		struct tmbr_tree *split;
+		struct tmbr_xdg_client *client;
+		struct tmbr_desktop *desktop;
+		struct wlr_box box;
+	} drag;
+
+	struct {
+		const char *phase;
+		struct timespec time;
+	} startup[8];
+	size_t startup_phases;
+	bool startup_profile;
+	bool realtime;
+	bool started;
 };
 
 static void tmbr_spawn(const char *path, char * const argv[])
@@ -230,6 +457,33 @@ static void tmbr_spawn(const char *path, char * const argv[])
 	waitpid(pid, NULL, 0);
 }
 
+static uint32_t tmbr_time_usec(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int tmbr_compare_latencies(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+	return (x > y) - (x < y);
+}
+
+static void tmbr_server_stamp_input(struct tmbr_server *server, uint32_t time_msec)
+{
+	/*
+	 * Timestamps are kept in microseconds and wrap around, which is fine
+	 * as we only ever look at the difference between two of them. Only
+	 * the oldest input which has not been answered by a client commit yet
+	 * is tracked, unless it is so old that it probably never will be.
+	 */
+	if (server->input_pending && tmbr_time_usec() - server->input_stamp < TMBR_LATENCY_TRACE_EXPIRY * 1000)
+		return;
+	server->input_stamp = time_msec * 1000;
+	server->input_pending = true;
+}
+
 static struct tmbr_xdg_client *tmbr_server_find_focus(struct tmbr_server *server)
 {
 	return server->input_inhibit->active_client ? NULL : server->focussed_screen->focus->focus;
@@ -238,7 +492,34 @@ static struct tmbr_xdg_client *tmbr_server_find_focus(struct tmbr_server *server
 static struct tmbr_screen *tmbr_server_find_screen_at(struct tmbr_server *server, double x, double y)
 {
 	struct wlr_output *output = wlr_output_layout_output_at(server->output_layout, x, y);
-	return output ? output->data : NULL;
+	struct tmbr_screen *screen = output ? output->data : NULL;
+	return (screen && !screen->mirror && !screen->disabled) ? screen : NULL;
+}
+
+/*
+ * Screens lay out their clients in output coordinates, whereas the X
+ * server positions windows in layout coordinates.
+ */
+static void tmbr_screen_get_origin(struct tmbr_screen *screen, double *x, double *y)
+{
+	*x = *y = 0;
+	wlr_output_layout_output_coords(screen->server->output_layout, screen->output, x, y);
+	*x = -*x;
+	*y = -*y;
+}
+
+static void tmbr_server_mark_startup(struct tmbr_server *server, const char *phase)
+{
+	struct timespec *start = &server->startup[0].time, *now;
+
+	if (server->startup_phases >= ARRAY_SIZE(server->startup))
+		return;
+	server->startup[server->startup_phases].phase = phase;
+	clock_gettime(CLOCK_MONOTONIC, now = &server->startup[server->startup_phases++].time);
+
+	if (server->startup_profile)
+		fprintf(stderr, "startup: %s after %.3fms\n", phase,
+			(now->tv_sec - start->tv_sec) * 1000.0 + (now->tv_nsec - start->tv_nsec) / 1000000.0);
 }
 
 static struct wl_list *tmbr_list_get(struct wl_list *head, struct wl_list *link, enum tmbr_ctrl_selection which)
@@ -271,40 +552,53 @@ static void tmbr_surface_send_frame_done(struct wlr_surface *surface, TMBR_UNUSE
 	wlr_surface_send_frame_done(surface, payload);
 }
 
+/*
+ * Intersect two boxes, returning whether the intersection is non-empty.
+ * Render paths use this to clip directly against the rectangles of the
+ * output damage, which avoids building a temporary region per surface.
+ */
+static bool tmbr_box_intersect(struct pixman_box32 *out, const struct pixman_box32 *a, const struct pixman_box32 *b)
+{
+	out->x1 = (a->x1 > b->x1) ? a->x1 : b->x1;
+	out->y1 = (a->y1 > b->y1) ? a->y1 : b->y1;
+	out->x2 = (a->x2 < b->x2) ? a->x2 : b->x2;
+	out->y2 = (a->y2 < b->y2) ? a->y2 : b->y2;
+	return out->x1 < out->x2 && out->y1 < out->y2;
+}
+
 static void tmbr_surface_render(struct wlr_surface *surface, int sx, int sy, void *payload)
 {
 	struct tmbr_surface_render_data *data = payload;
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(data->output->backend);
 	struct wlr_box bounds = data->box, extents = {
-		.x = bounds.x + sx * data->output->scale, .y = bounds.y + sy * data->output->scale,
-		.width = surface->current.width * data->output->scale, .height = surface->current.height * data->output->scale,
+		.x = bounds.x + sx * data->scale, .y = bounds.y + sy * data->scale,
+		.width = surface->current.width * data->scale, .height = surface->current.height * data->scale,
 	};
-	struct wlr_texture *texture;
-	struct pixman_region32 damage;
-	struct pixman_box32 *rects;
+	struct pixman_box32 clip, box, *rects;
+	struct wlr_texture *texture = NULL;
 	float matrix[9];
 	int i, nrects;
 
-	pixman_region32_init(&damage);
-	pixman_region32_union_rect(&damage, &damage, extents.x, extents.y, extents.width, extents.height);
-	pixman_region32_intersect_rect(&damage, &damage, bounds.x, bounds.y, bounds.width, bounds.height);
-	pixman_region32_intersect(&damage, &damage, data->damage);
-	if (!pixman_region32_not_empty(&damage) || (texture = wlr_surface_get_texture(surface)) == NULL)
-		goto out;
-	if (wlr_texture_is_gles2(texture)) {
-		struct wlr_gles2_texture_attribs attribs;
-		wlr_gles2_texture_get_attribs(texture, &attribs);
-		glBindTexture(attribs.target, attribs.tex);
-		glTexParameteri(attribs.target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	}
-	wlr_matrix_project_box(matrix, &extents, wlr_output_transform_invert(surface->current.transform), 0, data->output->transform_matrix);
+	if (!tmbr_box_intersect(&clip, &tmbr_box_to_pixman(extents), &tmbr_box_to_pixman(bounds)))
+		return;
 
-	for (i = 0, rects = pixman_region32_rectangles(&damage, &nrects); i < nrects; i++) {
-		wlr_renderer_scissor(wlr_backend_get_renderer(data->output->backend), &tmbr_box_from_pixman(rects[i]));
-		wlr_render_texture_with_matrix(wlr_backend_get_renderer(data->output->backend), texture, matrix, 1);
+	for (i = 0, rects = pixman_region32_rectangles(data->damage, &nrects); i < nrects; i++) {
+		if (!tmbr_box_intersect(&box, &clip, &rects[i]))
+			continue;
+		if (!texture) {
+			if ((texture = wlr_surface_get_texture(surface)) == NULL)
+				return;
+			if (wlr_texture_is_gles2(texture)) {
+				struct wlr_gles2_texture_attribs attribs;
+				wlr_gles2_texture_get_attribs(texture, &attribs);
+				glBindTexture(attribs.target, attribs.tex);
+				glTexParameteri(attribs.target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			}
+			wlr_matrix_project_box(matrix, &extents, wlr_output_transform_invert(surface->current.transform), 0, data->output->transform_matrix);
+		}
+		wlr_renderer_scissor(renderer, &tmbr_box_from_pixman(box));
+		wlr_render_texture_with_matrix(renderer, texture, matrix, 1);
 	}
-
-out:
-	pixman_region32_fini(&damage);
 }
 
 static void tmbr_surface_damage_surface(struct wlr_surface *surface, int sx, int sy, void *payload)
@@ -312,16 +606,16 @@ static void tmbr_surface_damage_surface(struct wlr_surface *surface, int sx, int
 	struct tmbr_surface_damage_data *data = payload;
 
 	if (pixman_region32_not_empty(&surface->buffer_damage)) {
-		struct pixman_region32 damage;
-		pixman_region32_init(&damage);
-		wlr_surface_get_effective_damage(surface, &damage);
-		pixman_region32_translate(&damage, data->x + sx, data->y + sy);
-		wlr_region_scale(&damage, &damage, data->screen->output->scale);
-		wlr_output_damage_add(data->screen->damage, &damage);
-		pixman_region32_fini(&damage);
+		struct pixman_region32 *damage = &data->screen->surface_damage;
+		wlr_surface_get_effective_damage(surface, damage);
+		pixman_region32_translate(damage, data->x + sx, data->y + sy);
+		if (data->screen->output->scale != 1)
+			wlr_region_scale(damage, damage, data->screen->output->scale);
+		wlr_output_damage_add(data->screen->damage, damage);
+		data->screen->scene_damaged = true;
 	}
 
-	if (!wl_list_empty(&surface->current.frame_callback_list))
+	if (!wl_list_empty(&surface->current.frame_callback_list) && data->screen->output->enabled)
 		wlr_output_schedule_frame(data->screen->output);
 }
 
@@ -350,13 +644,15 @@ static void tmbr_surface_notify_focus(struct wlr_surface *surface, struct wlr_su
 static void tmbr_xdg_popup_damage_whole(struct tmbr_xdg_popup *p)
 {
 	struct tmbr_xdg_client *c = p->client;
-	if (c->desktop && c->desktop == c->desktop->screen->focus)
+	if (c->desktop && c->desktop->screen && c->desktop == c->desktop->screen->focus) {
+		c->desktop->screen->scene_damaged = true;
 		wlr_output_damage_add_box(c->desktop->screen->damage, &tmbr_box_scaled(
 			c->x + c->border + p->surface->popup->geometry.x - p->surface->geometry.x,
 			c->y + c->border + p->surface->popup->geometry.y - p->surface->geometry.y,
 			p->surface->popup->geometry.width + p->surface->popup->geometry.x,
 			p->surface->popup->geometry.height + p->surface->popup->geometry.y,
 			c->desktop->screen->output->scale));
+	}
 }
 
 static void tmbr_xdg_popup_on_map(struct wl_listener *listener, TMBR_UNUSED void *payload)
@@ -391,46 +687,115 @@ static void tmbr_xdg_client_on_new_popup(struct wl_listener *listener, void *pay
 
 static void tmbr_xdg_client_damage_whole(struct tmbr_xdg_client *c)
 {
-	if (c->desktop && c->desktop == c->desktop->screen->focus) {
+	if (c->desktop && c->desktop->screen && c->desktop == c->desktop->screen->focus) {
 		struct wlr_box box = tmbr_box_scaled(c->x, c->y, c->w, c->h, c->desktop->screen->output->scale);
 		wlr_output_damage_add_box(c->desktop->screen->damage, &box);
+		c->desktop->screen->scene_damaged = true;
+	}
+}
+
+static struct wlr_surface *tmbr_xdg_client_get_surface(struct tmbr_xdg_client *client)
+{
+#if WLR_HAS_XWAYLAND
+	if (client->xsurface)
+		return client->xsurface->surface;
+#endif
+	return client->surface->surface;
+}
+
+static const char *tmbr_xdg_client_get_title(struct tmbr_xdg_client *client)
+{
+#if WLR_HAS_XWAYLAND
+	if (client->xsurface)
+		return client->xsurface->title;
+#endif
+	return client->surface->toplevel->title;
+}
+
+static const char *tmbr_xdg_client_get_app_id(struct tmbr_xdg_client *client)
+{
+#if WLR_HAS_XWAYLAND
+	if (client->xsurface)
+		return client->xsurface->class;
+#endif
+	return client->surface->toplevel->app_id;
+}
+
+static void tmbr_xdg_client_for_each_surface(struct tmbr_xdg_client *client, wlr_surface_iterator_func_t iterator, void *payload)
+{
+#if WLR_HAS_XWAYLAND
+	if (client->xsurface) {
+		wlr_surface_for_each_surface(client->xsurface->surface, iterator, payload);
+		return;
 	}
+#endif
+	wlr_xdg_surface_for_each_surface(client->surface, iterator, payload);
+}
+
+static struct wlr_surface *tmbr_xdg_client_surface_at(struct tmbr_xdg_client *client, double x, double y, double *sx, double *sy)
+{
+#if WLR_HAS_XWAYLAND
+	if (client->xsurface)
+		return wlr_surface_surface_at(client->xsurface->surface, x, y, sx, sy);
+#endif
+	return wlr_xdg_surface_surface_at(client->surface, x, y, sx, sy);
 }
 
 static void tmbr_xdg_client_kill(struct tmbr_xdg_client *client)
 {
+#if WLR_HAS_XWAYLAND
+	if (client->xsurface) {
+		wlr_xwayland_surface_close(client->xsurface);
+		return;
+	}
+#endif
 	wlr_xdg_toplevel_send_close(client->surface);
 }
 
+static void tmbr_xdg_client_set_fullscreen(struct tmbr_xdg_client *client, bool fullscreen)
+{
+#if WLR_HAS_XWAYLAND
+	if (client->xsurface) {
+		wlr_xwayland_surface_set_fullscreen(client->xsurface, fullscreen);
+		return;
+	}
+#endif
+	wlr_xdg_toplevel_set_fullscreen(client->surface, fullscreen);
+}
+
 static void tmbr_xdg_client_render(struct tmbr_xdg_client *c, struct pixman_region32 *output_damage)
 {
 	struct wlr_output *output = c->desktop->screen->output;
 	struct tmbr_surface_render_data payload = {
 		output_damage, output, tmbr_box_scaled(c->x + c->border, c->y + c->border, c->w - 2 * c->border, c->h - 2 * c->border, output->scale),
+		output->scale,
 	};
 
 	if (!pixman_region32_contains_rectangle(output_damage, &tmbr_box_to_pixman(payload.box)))
 		return;
 	if (c->border) {
 		const float *color = (c == tmbr_server_find_focus(c->server)) ? TMBR_COLOR_ACTIVE : TMBR_COLOR_INACTIVE;
-		struct pixman_region32 borders;
-		struct pixman_box32 *rects;
-		int i, nrects;
-
-		pixman_region32_init_with_extents(&borders, &tmbr_box_to_pixman(payload.box));
-		pixman_region32_inverse(&borders, &borders, &(struct pixman_box32){
+		struct pixman_box32 inner = tmbr_box_to_pixman(payload.box), outer = {
 			.x1 = c->x * output->scale, .x2 = (c->x + c->w) * output->scale,
 			.y1 = c->y * output->scale, .y2 = (c->y + c->h) * output->scale,
-		});
-		pixman_region32_intersect(&borders, &borders, output_damage);
-
-		for (i = 0, rects = pixman_region32_rectangles(&borders, &nrects); i < nrects; i++) {
-			wlr_renderer_scissor(wlr_backend_get_renderer(output->backend), &tmbr_box_from_pixman(rects[i]));
-			wlr_renderer_clear(wlr_backend_get_renderer(output->backend), color);
+		}, borders[4] = {
+			{ outer.x1, outer.y1, outer.x2, inner.y1 },
+			{ outer.x1, inner.y2, outer.x2, outer.y2 },
+			{ outer.x1, inner.y1, inner.x1, inner.y2 },
+			{ inner.x2, inner.y1, outer.x2, inner.y2 },
+		}, box, *rects;
+		int i, j, nrects;
+
+		for (i = 0, rects = pixman_region32_rectangles(output_damage, &nrects); i < nrects; i++) {
+			for (j = 0; j < 4; j++) {
+				if (!tmbr_box_intersect(&box, &borders[j], &rects[i]))
+					continue;
+				wlr_renderer_scissor(wlr_backend_get_renderer(output->backend), &tmbr_box_from_pixman(box));
+				wlr_renderer_clear(wlr_backend_get_renderer(output->backend), color);
+			}
 		}
-		pixman_region32_fini(&borders);
 	}
-	wlr_xdg_surface_for_each_surface(c->surface, tmbr_surface_render, &payload);
+	tmbr_xdg_client_for_each_surface(c, tmbr_surface_render, &payload);
 }
 
 static int tmbr_xdg_client_handle_configure_timer(void *client)
@@ -441,13 +806,23 @@ static int tmbr_xdg_client_handle_configure_timer(void *client)
 static void tmbr_xdg_client_notify_focus(struct tmbr_xdg_client *client)
 {
 	double x = client->server->cursor->x, y = client->server->cursor->y;
-	struct wlr_surface *subsurface = wlr_xdg_surface_surface_at(client->surface, x - client->x, y - client->y, &x, &y);
-	tmbr_surface_notify_focus(client->surface->surface, subsurface, client->server, x, y);
+	struct wlr_surface *subsurface = tmbr_xdg_client_surface_at(client, x - client->x, y - client->y, &x, &y);
+	tmbr_surface_notify_focus(tmbr_xdg_client_get_surface(client), subsurface, client->server, x, y);
 }
 
 static void tmbr_xdg_client_set_box(struct tmbr_xdg_client *client, int x, int y, int w, int h, int border)
 {
-	if (client->w != w || client->h != h || client->border != border) {
+	if (client->xsurface) {
+#if WLR_HAS_XWAYLAND
+		/* X11 windows are positioned by the X server and thus need to know their position, too */
+		if (client->w != w || client->h != h || client->border != border || client->x != x || client->y != y) {
+			double ox = 0, oy = 0;
+			if (client->desktop && client->desktop->screen)
+				tmbr_screen_get_origin(client->desktop->screen, &ox, &oy);
+			wlr_xwayland_surface_configure(client->xsurface, ox + x + border, oy + y + border, w - 2 * border, h - 2 * border);
+		}
+#endif
+	} else if (client->w != w || client->h != h || client->border != border) {
 		client->pending_serial = wlr_xdg_toplevel_set_size(client->surface, w - 2 * border, h - 2 * border);
 		wl_event_source_timer_update(client->configure_timer, 50);
 	}
@@ -460,18 +835,132 @@ static void tmbr_xdg_client_set_box(struct tmbr_xdg_client *client, int x, int y
 	}
 }
 
+static void tmbr_xdg_client_set_tiled(struct tmbr_xdg_client *client)
+{
+#if WLR_HAS_XWAYLAND
+	if (client->xsurface) {
+		wlr_xwayland_surface_set_maximized(client->xsurface, true);
+		return;
+	}
+#endif
+	/* Clients which do not know about tiled states get told to be maximized instead */
+	if (wl_resource_get_version(client->surface->resource) >= XDG_TOPLEVEL_STATE_TILED_LEFT_SINCE_VERSION)
+		wlr_xdg_toplevel_set_tiled(client->surface, WLR_EDGE_TOP|WLR_EDGE_BOTTOM|WLR_EDGE_LEFT|WLR_EDGE_RIGHT);
+	else
+		wlr_xdg_toplevel_set_maximized(client->surface, true);
+}
+
+static void tmbr_xdg_client_set_priority(struct tmbr_xdg_client *client, bool focus)
+{
+	int fd = client->server->cgroup_procs[focus];
+	char buf[32];
+	struct dirent *e;
+	DIR *tasks;
+
+	if (client->pid <= 0)
+		return;
+
+	if (fd >= 0) {
+		int len = snprintf(buf, sizeof(buf), "%d", client->pid);
+		if (write(fd, buf, len) < 0)
+			wlr_log(WLR_ERROR, "Could not move client %d into cgroup: %s", client->pid, strerror(errno));
+		return;
+	}
+
+	/* Nice values are tracked per thread, so all of the client's threads need to be adjusted */
+	snprintf(buf, sizeof(buf), "/proc/%d/task", client->pid);
+	if ((tasks = opendir(buf)) == NULL)
+		return;
+	while ((e = readdir(tasks)) != NULL)
+		if (e->d_name[0] != '.')
+			setpriority(PRIO_PROCESS, atoi(e->d_name), focus ? client->process->nice : client->process->nice + TMBR_CLIENT_BACKGROUND_NICE);
+	closedir(tasks);
+}
+
+static void tmbr_xdg_client_resolve_pid(struct tmbr_xdg_client *client)
+{
+	struct tmbr_process *process;
+	struct rlimit limit;
+	int nice;
+
+	if (client->xsurface) {
+#if WLR_HAS_XWAYLAND
+		client->pid = client->xsurface->pid;
+#endif
+	} else {
+		wl_client_get_credentials(wl_resource_get_client(client->surface->resource), &client->pid, NULL, NULL);
+	}
+	if (client->pid == getpid())
+		client->pid = 0;
+	if (client->pid <= 0 || client->server->cgroup_procs[0] >= 0)
+		return;
+
+	/*
+	 * The original priority is sampled once per process, as windows of
+	 * a process which already got backgrounded would otherwise pick up
+	 * the lowered priority as their baseline.
+	 */
+	wl_list_for_each(process, &client->server->processes, link) {
+		if (process->pid != client->pid)
+			continue;
+		process->refs++;
+		client->process = process;
+		return;
+	}
+
+	/*
+	 * Without CAP_SYS_NICE, RLIMIT_NICE determines whether we can
+	 * restore the original priority once the client regains focus.
+	 * Never lower the priority of clients we cannot raise again.
+	 */
+	errno = 0;
+	nice = getpriority(PRIO_PROCESS, client->pid);
+	if (errno || getrlimit(RLIMIT_NICE, &limit) < 0 ||
+	    (limit.rlim_cur != RLIM_INFINITY && 20 - (int) limit.rlim_cur > nice)) {
+		client->pid = 0;
+		return;
+	}
+
+	process = tmbr_alloc(sizeof(*process), "Could not allocate process");
+	process->pid = client->pid;
+	process->nice = nice;
+	process->refs = 1;
+	wl_list_insert(&client->server->processes, &process->link);
+	client->process = process;
+}
+
+static void tmbr_xdg_client_release_pid(struct tmbr_xdg_client *client)
+{
+	if (client->process && !--client->process->refs) {
+		wl_list_remove(&client->process->link);
+		free(client->process);
+	}
+	client->process = NULL;
+	client->pid = 0;
+}
+
 static void tmbr_xdg_client_focus(struct tmbr_xdg_client *client, bool focus)
 {
-	wlr_xdg_toplevel_set_activated(client->surface, focus);
+	if (client->xsurface) {
+#if WLR_HAS_XWAYLAND
+		wlr_xwayland_surface_activate(client->xsurface, focus);
+#endif
+	} else {
+		wlr_xdg_toplevel_set_activated(client->surface, focus);
+	}
+	if (client->toplevel_handle)
+		wlr_foreign_toplevel_handle_v1_set_activated(client->toplevel_handle, focus);
 	if (focus)
 		tmbr_xdg_client_notify_focus(client);
+	tmbr_xdg_client_set_priority(client, focus);
 	tmbr_xdg_client_damage_whole(client);
 }
 
 static void tmbr_xdg_client_on_destroy(struct wl_listener *listener, TMBR_UNUSED void *payload)
 {
 	struct tmbr_xdg_client *client = wl_container_of(listener, client, destroy);
-	tmbr_unregister(&client->destroy, &client->commit, &client->map, &client->unmap, &client->new_popup, &client->request_fullscreen, NULL);
+	tmbr_unregister(&client->destroy, &client->commit, &client->map, &client->unmap, &client->new_popup,
+			&client->request_fullscreen, &client->set_title, &client->set_app_id, NULL);
 	wl_event_source_remove(client->configure_timer);
 	free(client);
 }
@@ -479,11 +968,40 @@ static void tmbr_xdg_client_on_destroy(struct wl_listener *listener, TMBR_UNUSED
 static void tmbr_xdg_client_on_commit(struct wl_listener *listener, TMBR_UNUSED void *payload)
 {
 	struct tmbr_xdg_client *client = wl_container_of(listener, client, commit);
-	if (client->desktop && client->desktop == client->desktop->screen->focus) {
-		wlr_xdg_surface_for_each_surface(client->surface, tmbr_surface_damage_surface,
-						 &(struct tmbr_surface_damage_data){ client->desktop->screen, client->x + client->border, client->y + client->border });
-		if (client == tmbr_server_find_focus(client->server))
+	struct tmbr_screen *screen = client->desktop ? client->desktop->screen : NULL;
+
+	/*
+	 * The initial configure only gets sent after the initial commit, so
+	 * setting the tiled state here makes the client draw its first
+	 * buffer tiled already.
+	 */
+	if (!client->xsurface && !client->surface->configured)
+		tmbr_xdg_client_set_tiled(client);
+
+	if (screen && screen->overview) {
+		/* Only the thumbnail of the client's desktop needs to be refreshed */
+		client->desktop->thumbnail_dirty = true;
+		screen->scene_damaged = true;
+		if (client->desktop->thumbnail_box.width)
+			wlr_output_damage_add_box(screen->damage, &client->desktop->thumbnail_box);
+		else
+			wlr_output_damage_add_whole(screen->damage);
+	} else if (screen && client->desktop == screen->focus) {
+		tmbr_xdg_client_for_each_surface(client, tmbr_surface_damage_surface,
+						 &(struct tmbr_surface_damage_data){ screen, client->x + client->border, client->y + client->border });
+		if (client == tmbr_server_find_focus(client->server)) {
 			tmbr_xdg_client_notify_focus(client);
+			/*
+			 * Attribute pending input to the next output commit presenting this
+			 * client's response, unless the input is too old to have caused it.
+			 */
+			if (client->server->input_pending && !screen->input_pending &&
+			    tmbr_time_usec() - client->server->input_stamp < TMBR_LATENCY_TRACE_EXPIRY * 1000) {
+				screen->input_stamp = client->server->input_stamp;
+				screen->input_pending = true;
+			}
+			client->server->input_pending = false;
+		}
 	}
 	if (client->pending_serial && client->pending_serial == client->surface->configure_serial) {
 		tmbr_xdg_client_handle_configure_timer(client);
@@ -617,13 +1135,129 @@ static void tmbr_tree_remove(struct tmbr_tree **tree, struct tmbr_tree *node)
 	free(node);
 }
 
+static void tmbr_tree_free(struct tmbr_tree *tree)
+{
+	if (!tree)
+		return;
+	tmbr_tree_free(tree->left);
+	tmbr_tree_free(tree->right);
+	free(tree);
+}
+
+static void tmbr_tree_export(struct tmbr_tree *tree, FILE *f, int *index)
+{
+	if (tree->client) {
+		fprintf(f, "%d", (*index)++);
+		return;
+	}
+	fprintf(f, "%c%g(", tree->split == TMBR_SPLIT_VERTICAL ? 'v' : 'h', tree->ratio);
+	tmbr_tree_export(tree->left, f, index);
+	fputc(',', f);
+	tmbr_tree_export(tree->right, f, index);
+	fputc(')', f);
+}
+
+/*
+ * Parse a tree layout of the form "v50(0,h30.5(1,2))", where splits are given
+ * by their orientation and ratio and leaves by the index of the client.
+ * Every client taken from the array is cleared so that it cannot be used
+ * twice.
+ */
+static struct tmbr_tree *tmbr_tree_import(const char **layout, struct tmbr_xdg_client **clients, size_t nclients, struct tmbr_tree *parent)
+{
+	struct tmbr_tree *tree = tmbr_alloc(sizeof(*tree), "Unable to allocate tree node");
+	unsigned long value;
+	double ratio;
+	char *end;
+
+	tree->parent = parent;
+
+	if (**layout == 'v' || **layout == 'h') {
+		tree->split = (**layout == 'v') ? TMBR_SPLIT_VERTICAL : TMBR_SPLIT_HORIZONTAL;
+		ratio = strtod(*layout + 1, &end);
+		if (end == *layout + 1 || !(ratio >= 1 && ratio <= 99) || *end != '(')
+			goto err;
+		tree->ratio = ratio;
+		*layout = end + 1;
+
+		if ((tree->left = tmbr_tree_import(layout, clients, nclients, tree)) == NULL || *(*layout)++ != ',' ||
+		    (tree->right = tmbr_tree_import(layout, clients, nclients, tree)) == NULL || *(*layout)++ != ')')
+			goto err;
+	} else {
+		value = strtoul(*layout, &end, 10);
+		if (end == *layout || value >= nclients || !clients[value])
+			goto err;
+		tree->client = clients[value];
+		clients[value] = NULL;
+		*layout = end;
+	}
+
+	return tree;
+err:
+	tmbr_tree_free(tree);
+	return NULL;
+}
+
+static void tmbr_tree_get_box(struct tmbr_tree *tree, struct wlr_box *box)
+{
+	struct wlr_box left, right;
+
+	if (tree->client) {
+		*box = (struct wlr_box){ tree->client->x, tree->client->y, tree->client->w, tree->client->h };
+		return;
+	}
+
+	tmbr_tree_get_box(tree->left, &left);
+	tmbr_tree_get_box(tree->right, &right);
+	*box = (struct wlr_box){ left.x, left.y, right.x + right.width - left.x, right.y + right.height - left.y };
+}
+
+/*
+ * Find the innermost split whose border between its two children is within
+ * grabbing distance of the given position.
+ */
+static struct tmbr_tree *tmbr_tree_find_split_at(struct tmbr_tree *tree, double x, double y)
+{
+	struct wlr_box box, left;
+	struct tmbr_tree *split;
+	double distance;
+
+	if (!tree || tree->client)
+		return NULL;
+
+	tmbr_tree_get_box(tree, &box);
+	if (x < box.x || x > box.x + box.width || y < box.y || y > box.y + box.height)
+		return NULL;
+	if ((split = tmbr_tree_find_split_at(tree->left, x, y)) != NULL ||
+	    (split = tmbr_tree_find_split_at(tree->right, x, y)) != NULL)
+		return split;
+
+	tmbr_tree_get_box(tree->left, &left);
+	if (tree->split == TMBR_SPLIT_VERTICAL)
+		distance = x - (left.x + left.width);
+	else
+		distance = y - (left.y + left.height);
+	if (distance < -2 * TMBR_BORDER_WIDTH || distance > 2 * TMBR_BORDER_WIDTH)
+		return NULL;
+	return tree;
+}
+
 static struct tmbr_desktop *tmbr_desktop_new(void)
 {
 	return tmbr_alloc(sizeof(struct tmbr_desktop), "Could not allocate desktop");
 }
 
+static void tmbr_desktop_drop_thumbnail(struct tmbr_desktop *desktop)
+{
+	if (desktop->thumbnail)
+		wlr_texture_destroy(desktop->thumbnail);
+	desktop->thumbnail = NULL;
+	desktop->thumbnail_box = (struct wlr_box){ 0 };
+}
+
 static void tmbr_desktop_free(struct tmbr_desktop *desktop)
 {
+	tmbr_desktop_drop_thumbnail(desktop);
 	free(desktop);
 }
 
@@ -637,6 +1271,9 @@ static struct tmbr_desktop *tmbr_desktop_find_sibling(struct tmbr_desktop *deskt
 
 static void tmbr_desktop_recalculate(struct tmbr_desktop *desktop)
 {
+	desktop->thumbnail_dirty = true;
+	if (!desktop->screen)
+		return;
 	if (desktop->fullscreen && desktop->focus)
 		tmbr_xdg_client_set_box(desktop->focus, desktop->screen->box.x, desktop->screen->box.y,
 					desktop->screen->box.width, desktop->screen->box.height, 0);
@@ -645,15 +1282,26 @@ static void tmbr_desktop_recalculate(struct tmbr_desktop *desktop)
 				      desktop->screen->box.width, desktop->screen->box.height);
 }
 
+static bool tmbr_desktop_is_configuring(struct tmbr_desktop *desktop)
+{
+	tmbr_tree_for_each(desktop->clients, tree)
+		if (tree->client->pending_serial)
+			return true;
+	return false;
+}
+
 static void tmbr_desktop_set_fullscreen(struct tmbr_desktop *desktop, bool fullscreen)
 {
 	if (desktop->fullscreen == fullscreen)
 		return;
 	desktop->fullscreen = fullscreen;
 	if (desktop->focus)
-		wlr_xdg_toplevel_set_fullscreen(desktop->focus->surface, fullscreen);
+		tmbr_xdg_client_set_fullscreen(desktop->focus, fullscreen);
+	if (desktop->focus && desktop->focus->toplevel_handle)
+		wlr_foreign_toplevel_handle_v1_set_fullscreen(desktop->focus->toplevel_handle, fullscreen);
 	tmbr_desktop_recalculate(desktop);
-	wlr_output_damage_add_whole(desktop->screen->damage);
+	if (desktop->screen)
+		wlr_output_damage_add_whole(desktop->screen->damage);
 }
 
 static void tmbr_desktop_focus_client(struct tmbr_desktop *desktop, struct tmbr_xdg_client *client, bool inputfocus)
@@ -674,21 +1322,29 @@ static void tmbr_desktop_add_client(struct tmbr_desktop *desktop, struct tmbr_xd
 {
 	tmbr_tree_insert(desktop->focus ? &desktop->focus->tree : &desktop->clients, client);
 	client->desktop = desktop;
+	if (client->toplevel_handle)
+		wlr_foreign_toplevel_handle_v1_output_enter(client->toplevel_handle, desktop->screen->output);
 	tmbr_desktop_set_fullscreen(desktop, false);
 	tmbr_desktop_recalculate(desktop);
 }
 
 static void tmbr_desktop_remove_client(struct tmbr_desktop *desktop, struct tmbr_xdg_client *client)
 {
+	if (client->server->drag.desktop == desktop) {
+		client->server->drag.split = NULL;
+		client->server->drag.client = NULL;
+	}
 	if (desktop->focus == client) {
 		enum tmbr_ctrl_selection sel = (client->tree->parent && client->tree->parent->left == client->tree)
 			? TMBR_CTRL_SELECTION_NEXT : TMBR_CTRL_SELECTION_PREV;
 		struct tmbr_tree *sibling = tmbr_tree_find_sibling(client->tree, sel);
-		tmbr_desktop_focus_client(desktop, sibling ? sibling->client : NULL, true);
+		tmbr_desktop_focus_client(desktop, sibling ? sibling->client : NULL, desktop->screen != NULL);
 	}
 	tmbr_tree_remove(&desktop->clients, client->tree);
 	tmbr_desktop_set_fullscreen(desktop, false);
 	tmbr_desktop_recalculate(desktop);
+	if (client->toplevel_handle && desktop->screen)
+		wlr_foreign_toplevel_handle_v1_output_leave(client->toplevel_handle, desktop->screen->output);
 	client->desktop = NULL;
 	client->tree = NULL;
 }
@@ -733,19 +1389,51 @@ static void tmbr_screen_remove_desktop(struct tmbr_screen *screen, struct tmbr_d
 	wl_list_remove(&desktop->link);
 }
 
+static void tmbr_desktop_set_screen(struct tmbr_desktop *desktop, struct tmbr_screen *screen)
+{
+	tmbr_tree_for_each(desktop->clients, tree) {
+		if (!tree->client->toplevel_handle)
+			continue;
+		if (desktop->screen && desktop->screen != screen)
+			wlr_foreign_toplevel_handle_v1_output_leave(tree->client->toplevel_handle, desktop->screen->output);
+		if (screen && desktop->screen != screen)
+			wlr_foreign_toplevel_handle_v1_output_enter(tree->client->toplevel_handle, screen->output);
+	}
+	/* Thumbnails belong to the renderer of the previous screen */
+	if (desktop->screen != screen)
+		tmbr_desktop_drop_thumbnail(desktop);
+	desktop->screen = screen;
+}
+
 static void tmbr_screen_add_desktop(struct tmbr_screen *screen, struct tmbr_desktop *desktop)
 {
 	wl_list_insert(screen->focus ? &screen->focus->link : &screen->desktops, &desktop->link);
-	desktop->screen = screen;
+	tmbr_desktop_set_screen(desktop, screen);
 	tmbr_screen_focus_desktop(screen, desktop);
 }
 
 static struct tmbr_screen *tmbr_screen_find_sibling(struct tmbr_screen *screen, enum tmbr_ctrl_selection which)
 {
-	struct wl_list *sibling;
-	if ((sibling = tmbr_list_get(&screen->server->screens, &screen->link, which)) == NULL)
-		return NULL;
-	return wl_container_of(sibling, screen, link);;
+	struct wl_list *link = &screen->link;
+	struct tmbr_screen *sibling;
+
+	/* Mirroring and disabled screens do not own any desktops and thus cannot be selected */
+	do {
+		if ((link = tmbr_list_get(&screen->server->screens, link, which)) == NULL)
+			return NULL;
+		sibling = wl_container_of(link, sibling, link);
+	} while ((sibling->mirror || sibling->disabled) && sibling != screen);
+
+	return (sibling != screen) ? sibling : NULL;
+}
+
+static struct wlr_output_mode *tmbr_screen_find_mode(struct tmbr_screen *screen, int32_t width, int32_t height, int32_t refresh)
+{
+	struct wlr_output_mode *mode;
+	wl_list_for_each(mode, &screen->output->modes, link)
+		if (width == mode->width && height == mode->height && refresh == mode->refresh)
+			return mode;
+	return NULL;
 }
 
 static struct tmbr_layer_client *tmbr_screen_find_layer_client_at(struct tmbr_screen *screen, double x, double y)
@@ -771,41 +1459,500 @@ static struct tmbr_xdg_client *tmbr_screen_find_xdg_client_at(struct tmbr_screen
 	return NULL;
 }
 
-static void tmbr_screen_on_destroy(struct wl_listener *listener, TMBR_UNUSED void *payload)
+static void tmbr_screen_render_layer(struct tmbr_screen *screen, struct pixman_region32 *output_damage, enum zwlr_layer_shell_v1_layer layer)
 {
-	struct tmbr_screen *screen = wl_container_of(listener, screen, destroy), *sibling = tmbr_screen_find_sibling(screen, TMBR_CTRL_SELECTION_NEXT);
-	struct tmbr_desktop *desktop, *tmp;
-	struct tmbr_layer_client *c, *ctmp;
-
-	if (sibling) {
-		wl_list_for_each_safe(desktop, tmp, &screen->desktops, link)
-			tmbr_screen_add_desktop(sibling, desktop);
-		wl_list_init(&screen->desktops);
-	} else {
-		wl_list_for_each(desktop, &screen->desktops, link) {
-			tmbr_tree_for_each(desktop->clients, t)
-				tmbr_desktop_remove_client(desktop, t->client);
+		struct tmbr_layer_client *c;
+		wl_list_for_each(c, &screen->layer_clients, link) {
+			struct tmbr_surface_render_data data = {
+				output_damage, screen->output, tmbr_box_scaled(c->x, c->y, c->w, c->h, screen->output->scale),
+				screen->output->scale,
+			};
+			if (c->surface->current.layer == layer)
+				wlr_layer_surface_v1_for_each_surface(c->surface, tmbr_surface_render, &data);
 		}
-		wl_display_terminate(screen->server->display);
-	}
-	wl_list_for_each_safe(c, ctmp, &screen->layer_clients, link)
-		wlr_layer_surface_v1_close(c->surface);
+}
 
-	tmbr_unregister(&screen->destroy, &screen->frame, &screen->mode, &screen->commit, NULL);
-	wl_list_remove(&screen->link);
-	free(screen);
+static struct wlr_box tmbr_screen_get_overview_cell(struct tmbr_screen *screen, int i)
+{
+	int n = wl_list_length(&screen->desktops), cols, rows;
+	for (cols = 1; cols * cols < n; cols++);
+	rows = (n + cols - 1) / cols;
+	return (struct wlr_box){
+		.x = screen->box.x + (i % cols) * screen->box.width / cols, .y = screen->box.y + (i / cols) * screen->box.height / rows,
+		.width = screen->box.width / cols, .height = screen->box.height / rows,
+	};
 }
 
-static void tmbr_screen_render_layer(struct tmbr_screen *screen, struct pixman_region32 *output_damage, enum zwlr_layer_shell_v1_layer layer)
+static void tmbr_desktop_snapshot(struct tmbr_desktop *desktop, struct wlr_output *output, struct wlr_box *box)
 {
-		struct tmbr_layer_client *c;
-		wl_list_for_each(c, &screen->layer_clients, link) {
-			struct tmbr_surface_render_data data = {
-				output_damage, screen->output, tmbr_box_scaled(c->x, c->y, c->w, c->h, screen->output->scale),
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(output->backend);
+	uint32_t *pixels = tmbr_alloc(box->width * box->height * 4, "Could not allocate thumbnail");
+
+	if (!wlr_renderer_read_pixels(renderer, TMBR_FORMAT_ABGR8888, NULL, box->width * 4, box->width, box->height,
+				      box->x, box->y, 0, 0, pixels))
+		goto out;
+
+	if (desktop->thumbnail && (desktop->thumbnail->width != (uint32_t) box->width || desktop->thumbnail->height != (uint32_t) box->height ||
+				   !wlr_texture_write_pixels(desktop->thumbnail, box->width * 4, box->width, box->height, 0, 0, 0, 0, pixels)))
+		tmbr_desktop_drop_thumbnail(desktop);
+	if (!desktop->thumbnail &&
+	    (desktop->thumbnail = wlr_texture_from_pixels(renderer, TMBR_FORMAT_XBGR8888, box->width * 4, box->width, box->height, pixels)) == NULL)
+		goto out;
+	desktop->thumbnail_dirty = false;
+
+out:
+	free(pixels);
+}
+
+static void tmbr_screen_render_overview(struct tmbr_screen *screen, struct pixman_region32 *damage)
+{
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(screen->output->backend);
+	struct wlr_output *output = screen->output;
+	struct tmbr_desktop *d;
+	int i = 0;
+
+	wlr_renderer_clear(renderer, (float[4]){0.1, 0.1, 0.1, 1.0});
+
+	/*
+	 * Every desktop is drawn once as a thumbnail from the textures its
+	 * clients have last committed, which then gets read back into a
+	 * texture at thumbnail size. Following frames only draw that
+	 * texture until a client of the desktop commits. Clients are
+	 * neither reconfigured nor asked to redraw.
+	 */
+	wl_list_for_each(d, &screen->desktops, link) {
+		struct wlr_box cell = tmbr_screen_get_overview_cell(screen, i++), thumb, box;
+		double sx = (cell.width - 4.0 * TMBR_BORDER_WIDTH) / screen->box.width, sy = (cell.height - 4.0 * TMBR_BORDER_WIDTH) / screen->box.height;
+		double scale = (sx < sy) ? sx : sy;
+
+		thumb.width = screen->box.width * scale;
+		thumb.height = screen->box.height * scale;
+		thumb.x = cell.x + (cell.width - thumb.width) / 2;
+		thumb.y = cell.y + (cell.height - thumb.height) / 2;
+		box = d->thumbnail_box = tmbr_box_scaled(thumb.x, thumb.y, thumb.width, thumb.height, output->scale);
+
+		wlr_renderer_scissor(renderer, &tmbr_box_scaled(thumb.x - TMBR_BORDER_WIDTH, thumb.y - TMBR_BORDER_WIDTH,
+								thumb.width + 2 * TMBR_BORDER_WIDTH, thumb.height + 2 * TMBR_BORDER_WIDTH, output->scale));
+		wlr_renderer_clear(renderer, (d == screen->focus) ? TMBR_COLOR_ACTIVE : TMBR_COLOR_INACTIVE);
+		wlr_renderer_scissor(renderer, &box);
+		wlr_renderer_clear(renderer, (float[4]){0.3, 0.3, 0.3, 1.0});
+		wlr_renderer_scissor(renderer, NULL);
+
+		if (d->thumbnail && !d->thumbnail_dirty &&
+		    d->thumbnail->width == (uint32_t) box.width && d->thumbnail->height == (uint32_t) box.height) {
+			wlr_render_texture(renderer, d->thumbnail, output->transform_matrix, box.x, box.y, 1);
+			continue;
+		}
+
+		tmbr_tree_for_each(d->clients, tree) {
+			struct tmbr_xdg_client *c = tree->client;
+			struct tmbr_surface_render_data payload = {
+				damage, output, tmbr_box_scaled(thumb.x + (c->x + c->border - screen->box.x) * scale,
+								 thumb.y + (c->y + c->border - screen->box.y) * scale,
+								 (c->w - 2 * c->border) * scale, (c->h - 2 * c->border) * scale, output->scale),
+				output->scale * scale,
 			};
-			if (c->surface->current.layer == layer)
-				wlr_layer_surface_v1_for_each_surface(c->surface, tmbr_surface_render, &data);
+			if (d->fullscreen && c != d->focus)
+				continue;
+			tmbr_xdg_client_for_each_surface(c, tmbr_surface_render, &payload);
 		}
+
+		/* The snapshot can only be taken if the thumbnail has been drawn completely */
+		if (box.width > 0 && box.height > 0 && output->transform == WL_OUTPUT_TRANSFORM_NORMAL &&
+		    pixman_region32_contains_rectangle(damage, &tmbr_box_to_pixman(box)) == PIXMAN_REGION_IN)
+			tmbr_desktop_snapshot(d, output, &box);
+	}
+}
+
+static struct tmbr_desktop *tmbr_screen_find_overview_desktop_at(struct tmbr_screen *screen, double x, double y)
+{
+	struct tmbr_desktop *d;
+	int i = 0;
+	wl_list_for_each(d, &screen->desktops, link) {
+		struct wlr_box cell = tmbr_screen_get_overview_cell(screen, i++);
+		if (cell.x <= x && cell.x + cell.width > x && cell.y <= y && cell.y + cell.height > y)
+			return d;
+	}
+	return NULL;
+}
+
+static void tmbr_screen_set_overview(struct tmbr_screen *screen, bool overview)
+{
+	if (screen->overview == overview)
+		return;
+	screen->overview = overview;
+	wlr_output_damage_add_whole(screen->damage);
+	if (overview) {
+		wlr_seat_pointer_notify_clear_focus(screen->server->seat);
+		wlr_seat_keyboard_notify_clear_focus(screen->server->seat);
+		wlr_xcursor_manager_set_cursor_image(screen->server->xcursor, "left_ptr", screen->server->cursor);
+	} else {
+		struct tmbr_desktop *d;
+		wl_list_for_each(d, &screen->desktops, link)
+			tmbr_desktop_drop_thumbnail(d);
+		/* Restores keyboard focus to the selected desktop's client */
+		tmbr_screen_focus_desktop(screen, screen->focus);
+	}
+}
+
+/*
+ * Copy the render buffer of a mirrored screen which cannot export it as
+ * DMA-BUF, so that its mirrors can upload it themselves.
+ */
+static void tmbr_screen_read_back(struct tmbr_screen *screen)
+{
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(screen->output->backend);
+	size_t size = screen->output->width * screen->output->height * 4;
+
+	if (size > screen->readback.size) {
+		free(screen->readback.pixels);
+		screen->readback.pixels = tmbr_alloc(size, "Could not allocate mirror buffer");
+		screen->readback.size = size;
+	}
+	if (!wlr_renderer_read_pixels(renderer, TMBR_FORMAT_ABGR8888, NULL, screen->output->width * 4,
+				      screen->output->width, screen->output->height, 0, 0, 0, 0, screen->readback.pixels)) {
+		wlr_log(WLR_ERROR, "Could not read back screen %s for mirroring", screen->output->name);
+		screen->readback.width = screen->readback.height = 0;
+		return;
+	}
+	screen->readback.width = screen->output->width;
+	screen->readback.height = screen->output->height;
+	screen->readback.serial++;
+}
+
+static bool tmbr_screen_can_read_back(struct tmbr_screen *screen)
+{
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(screen->output->backend);
+	uint32_t pixel;
+	bool ok;
+
+	if (!wlr_output_attach_render(screen->output, NULL))
+		return false;
+	wlr_renderer_begin(renderer, screen->output->width, screen->output->height);
+	ok = wlr_renderer_read_pixels(renderer, TMBR_FORMAT_ABGR8888, NULL, sizeof(pixel), 1, 1, 0, 0, 0, 0, &pixel);
+	wlr_renderer_end(renderer);
+	wlr_output_rollback(screen->output);
+	return ok;
+}
+
+static struct wlr_texture *tmbr_screen_get_mirror_texture(struct tmbr_screen *screen)
+{
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(screen->output->backend);
+	struct tmbr_screen *source = screen->mirror;
+	struct wlr_texture **texture = &screen->readback.texture;
+	uint32_t width = source->readback.width, height = source->readback.height;
+
+	if (!width || !height)
+		return NULL;
+	if (screen->readback.serial == source->readback.serial && *texture)
+		return *texture;
+
+	if (*texture && ((*texture)->width != width || (*texture)->height != height ||
+			 !wlr_texture_write_pixels(*texture, width * 4, width, height, 0, 0, 0, 0, source->readback.pixels))) {
+		wlr_texture_destroy(*texture);
+		*texture = NULL;
+	}
+	if (!*texture)
+		*texture = wlr_texture_from_pixels(renderer, TMBR_FORMAT_XBGR8888, width * 4, width, height, source->readback.pixels);
+	screen->readback.serial = source->readback.serial;
+	return *texture;
+}
+
+static void tmbr_screen_render_mirror(struct tmbr_screen *screen)
+{
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(screen->output->backend);
+	struct tmbr_screen *source = screen->mirror;
+	struct wlr_texture *texture = NULL, *imported = NULL;
+	struct wlr_dmabuf_attributes attribs;
+	struct pixman_region32 damage;
+	bool needs_frame, exported = false;
+
+	pixman_region32_init(&damage);
+	if (!wlr_output_damage_attach_render(screen->damage, &needs_frame, &damage))
+		goto out;
+	if (!needs_frame) {
+		wlr_output_rollback(screen->output);
+		goto out;
+	}
+
+	wlr_renderer_begin(renderer, screen->output->width, screen->output->height);
+	wlr_renderer_clear(renderer, (float[4]){0.0, 0.0, 0.0, 1.0});
+
+	/*
+	 * The source's front buffer gets imported as a texture without
+	 * copying it if possible. Otherwise, the source reads back each
+	 * frame it renders so that we can upload it.
+	 */
+	if (!source->readback.enabled && (exported = wlr_output_export_dmabuf(source->output, &attribs)))
+		texture = imported = wlr_texture_from_dmabuf(renderer, &attribs);
+	if (!texture && !source->readback.enabled) {
+		source->readback.enabled = true;
+		wlr_output_damage_add_whole(source->damage);
+	}
+	if (!texture)
+		texture = tmbr_screen_get_mirror_texture(screen);
+
+	/* The source's buffer is transformed, so it needs to be undone and scaled with its aspect ratio kept intact */
+	if (texture) {
+		bool rotated = source->output->transform % 2;
+		int width = rotated ? texture->height : texture->width, height = rotated ? texture->width : texture->height;
+		double sx = (double) screen->output->width / width, sy = (double) screen->output->height / height;
+		double scale = (sx < sy) ? sx : sy;
+		struct wlr_box box = { .width = width * scale, .height = height * scale };
+		float matrix[9];
+
+		box.x = (screen->output->width - box.width) / 2;
+		box.y = (screen->output->height - box.height) / 2;
+		wlr_matrix_project_box(matrix, &box, wlr_output_transform_invert(source->output->transform), 0,
+				       screen->output->transform_matrix);
+		wlr_render_texture_with_matrix(renderer, texture, matrix, 1);
+	}
+	if (imported)
+		wlr_texture_destroy(imported);
+	if (exported)
+		wlr_dmabuf_attributes_finish(&attribs);
+
+	wlr_renderer_end(renderer);
+	wlr_output_commit(screen->output);
+
+out:
+	pixman_region32_fini(&damage);
+}
+
+static bool tmbr_screen_is_mirrored(struct tmbr_screen *screen)
+{
+	struct tmbr_screen *s;
+	wl_list_for_each(s, &screen->server->screens, link)
+		if (s->mirror == screen)
+			return true;
+	return false;
+}
+
+static void tmbr_surface_count(TMBR_UNUSED struct wlr_surface *surface, TMBR_UNUSED int sx, TMBR_UNUSED int sy, void *payload)
+{
+	(*(int *) payload)++;
+}
+
+static bool tmbr_screen_wants_async(struct tmbr_screen *screen)
+{
+	struct tmbr_tearing_control *tc;
+	struct wlr_surface *surface;
+
+	/* Mirroring and disabled screens do not have any desktop */
+	if (!screen->focus || !screen->focus->fullscreen || !screen->focus->focus)
+		return false;
+	surface = tmbr_xdg_client_get_surface(screen->focus->focus);
+	wl_list_for_each(tc, &screen->server->tearing_controls, link)
+		if (tc->surface == surface)
+			return tc->current == WP_TEARING_CONTROL_V1_PRESENTATION_HINT_ASYNC;
+	return false;
+}
+
+static bool tmbr_screen_scan_out(struct tmbr_screen *screen, struct tmbr_xdg_client *client)
+{
+	struct wlr_surface *surface = tmbr_xdg_client_get_surface(client);
+	struct wlr_output *output = screen->output;
+	struct wlr_output_cursor *cursor;
+	struct tmbr_layer_client *c;
+	int nsurfaces = 0;
+
+	/* Only a single buffer covering the whole output can be handed to the output directly */
+	tmbr_xdg_client_for_each_surface(client, tmbr_surface_count, &nsurfaces);
+	if (nsurfaces != 1 || !surface->buffer || surface->current.transform != output->transform ||
+	    surface->current.buffer_width != output->width || surface->current.buffer_height != output->height ||
+	    !wl_list_empty(&screen->server->xwayland_unmanaged) || screen->readback.enabled)
+		return false;
+
+	/* Anything we draw on top of fullscreen clients rules out scanout, too */
+	if (screen->overview || screen->server->input_inhibit->active_client)
+		return false;
+	wl_list_for_each(c, &screen->layer_clients, link)
+		if (c->surface->mapped && c->surface->current.layer == ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY)
+			return false;
+	wl_list_for_each(cursor, &output->cursors, link)
+		if (cursor->enabled && cursor->visible && cursor != output->hardware_cursor)
+			return false;
+
+#if WLR_VERSION_MAJOR == 0 && WLR_VERSION_MINOR < 12
+	wlr_output_attach_buffer(output, surface->buffer);
+#else
+	wlr_output_attach_buffer(output, &surface->buffer->base);
+#endif
+	if (!wlr_output_test(output)) {
+		wlr_output_rollback(output);
+		return false;
+	}
+	return wlr_output_commit(output);
+}
+
+static void tmbr_screen_on_present(struct tmbr_screen *screen)
+{
+	struct tmbr_screen *mirror;
+
+	if (screen->input_pending) {
+		screen->latencies[screen->nlatencies++ % ARRAY_SIZE(screen->latencies)] = tmbr_time_usec() - screen->input_stamp;
+		screen->input_pending = false;
+	}
+	if (!screen->server->started) {
+		tmbr_server_mark_startup(screen->server, "first frame");
+		screen->server->started = true;
+	}
+	wl_list_for_each(mirror, &screen->server->screens, link)
+		if (mirror->mirror == screen)
+			wlr_output_damage_add_whole(mirror->damage);
+}
+
+#if WLR_HAS_XWAYLAND
+static void tmbr_screen_render_unmanaged(struct tmbr_screen *screen, struct pixman_region32 *output_damage)
+{
+	struct tmbr_xwayland_unmanaged *u;
+	double ox, oy;
+
+	tmbr_screen_get_origin(screen, &ox, &oy);
+	wl_list_for_each_reverse(u, &screen->server->xwayland_unmanaged, link) {
+		struct wlr_box box = { u->surface->x, u->surface->y, u->surface->width, u->surface->height };
+		struct tmbr_surface_render_data payload = {
+			output_damage, screen->output,
+			tmbr_box_scaled(box.x - ox, box.y - oy, box.width, box.height, screen->output->scale),
+			screen->output->scale,
+		};
+		if (!wlr_output_layout_intersects(screen->server->output_layout, screen->output, &box))
+			continue;
+		wlr_surface_for_each_surface(u->surface->surface, tmbr_surface_render, &payload);
+	}
+}
+
+static void tmbr_screen_send_unmanaged_frame_done(struct tmbr_screen *screen, struct timespec *time)
+{
+	struct tmbr_xwayland_unmanaged *u;
+	wl_list_for_each(u, &screen->server->xwayland_unmanaged, link)
+		wlr_surface_for_each_surface(u->surface->surface, tmbr_surface_send_frame_done, time);
+}
+#endif
+
+static bool tmbr_screen_get_software_cursor(struct tmbr_screen *screen, struct wlr_box *box)
+{
+	struct wlr_output_cursor *cursor, *software = NULL;
+
+	wl_list_for_each(cursor, &screen->output->cursors, link) {
+		if (!cursor->enabled || !cursor->visible || cursor == screen->output->hardware_cursor)
+			continue;
+		if (software)
+			return false;
+		software = cursor;
+	}
+	if (!software || screen->output->transform != WL_OUTPUT_TRANSFORM_NORMAL)
+		return false;
+
+	*box = (struct wlr_box){ software->x - software->hotspot_x, software->y - software->hotspot_y, software->width, software->height };
+	return box->width > 0 && box->height > 0 && box->x >= 0 && box->y >= 0 &&
+		box->x + box->width <= screen->output->width && box->y + box->height <= screen->output->height;
+}
+
+/*
+ * Save the contents of the current render buffer underneath the software
+ * cursor, which must have been fully redrawn without the cursor. Frames
+ * which changed the scene only invalidate the saved contents, as reading
+ * them back would stall every frame of e.g. a playing video. They get
+ * captured again once the cursor alone starts moving.
+ */
+static void tmbr_screen_save_under(struct tmbr_screen *screen, struct pixman_region32 *damage)
+{
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(screen->output->backend);
+	struct wlr_texture **texture = &screen->save_under[screen->save_under_next].texture;
+	struct wlr_box box;
+	size_t size;
+
+	if (screen->scene_damaged || !tmbr_screen_get_software_cursor(screen, &box) ||
+	    pixman_region32_contains_rectangle(damage, &tmbr_box_to_pixman(box)) != PIXMAN_REGION_IN)
+		goto err;
+
+	if ((size = box.width * box.height * 4) > screen->save_under_size) {
+		free(screen->save_under_pixels);
+		screen->save_under_pixels = tmbr_alloc(size, "Could not allocate cursor save-under");
+		screen->save_under_size = size;
+	}
+	if (!wlr_renderer_read_pixels(renderer, TMBR_FORMAT_ABGR8888, NULL, box.width * 4, box.width, box.height,
+				      box.x, box.y, 0, 0, screen->save_under_pixels))
+		goto err;
+
+	if (*texture && ((*texture)->width != (uint32_t) box.width || (*texture)->height != (uint32_t) box.height ||
+			 !wlr_texture_write_pixels(*texture, box.width * 4, box.width, box.height, 0, 0, 0, 0, screen->save_under_pixels))) {
+		wlr_texture_destroy(*texture);
+		*texture = NULL;
+	}
+	if (!*texture && (*texture = wlr_texture_from_pixels(renderer, TMBR_FORMAT_XBGR8888, box.width * 4,
+							      box.width, box.height, screen->save_under_pixels)) == NULL)
+		goto err;
+
+	screen->save_under[screen->save_under_next].box = box;
+	screen->save_under_next = (screen->save_under_next + 1) % TMBR_SAVE_UNDER_FRAMES;
+	screen->save_under_frames++;
+	return;
+err:
+	screen->save_under_frames = 0;
+}
+
+/*
+ * If the software cursor is the only thing that changed since the current
+ * render buffer was drawn, then it suffices to restore the contents saved
+ * underneath the cursor positions of the last frames. This avoids walking
+ * and rendering the complete scene for pointer movement on outputs without
+ * a cursor plane. On success, the damage that needs to be passed to the
+ * cursor rendering is stored in the screen's cursor damage.
+ */
+static bool tmbr_screen_restore_save_under(struct tmbr_screen *screen, struct pixman_region32 *damage)
+{
+	struct wlr_renderer *renderer = wlr_backend_get_renderer(screen->output->backend);
+	struct pixman_box32 *rects;
+	struct wlr_box box;
+	size_t j, slot;
+	int i, nrects;
+
+	if (!tmbr_screen_get_software_cursor(screen, &box)) {
+		screen->save_under_frames = 0;
+		return false;
+	}
+
+	pixman_region32_clear(&screen->cursor_damage);
+	pixman_region32_union_rect(&screen->cursor_damage, &screen->cursor_damage, box.x, box.y, box.width, box.height);
+	for (j = 0; j < screen->save_under_frames && j < TMBR_SAVE_UNDER_FRAMES; j++) {
+		slot = (screen->save_under_next + TMBR_SAVE_UNDER_FRAMES - 1 - j) % TMBR_SAVE_UNDER_FRAMES;
+		pixman_region32_union_rect(&screen->cursor_damage, &screen->cursor_damage, screen->save_under[slot].box.x,
+					   screen->save_under[slot].box.y, screen->save_under[slot].box.width, screen->save_under[slot].box.height);
+	}
+
+	/* Any damage not caused by the cursor requires the scene to be redrawn */
+	for (i = 0, rects = pixman_region32_rectangles(damage, &nrects); i < nrects; i++)
+		if (pixman_region32_contains_rectangle(&screen->cursor_damage, &rects[i]) != PIXMAN_REGION_IN)
+			screen->scene_damaged = true;
+	if (screen->scene_damaged) {
+		screen->save_under_frames = 0;
+		return false;
+	}
+	if (screen->save_under_frames < TMBR_SAVE_UNDER_FRAMES)
+		return false;
+
+	wlr_renderer_scissor(renderer, NULL);
+	for (j = 0; j < TMBR_SAVE_UNDER_FRAMES; j++) {
+		slot = (screen->save_under_next + j) % TMBR_SAVE_UNDER_FRAMES;
+		wlr_render_texture(renderer, screen->save_under[slot].texture, screen->output->transform_matrix,
+				   screen->save_under[slot].box.x, screen->save_under[slot].box.y, 1);
+	}
+	pixman_region32_union(&screen->cursor_damage, &screen->cursor_damage, damage);
+
+	return true;
+}
+
+/*
+ * Count how often the rectangle storage of the frame and cursor damage
+ * got reallocated, which is detected by its data pointer having changed.
+ * This does not account for any other allocation done while rendering.
+ */
+static void tmbr_screen_count_damage_reallocation(struct tmbr_screen *screen, struct pixman_region32 *region, pixman_region32_data_t *data)
+{
+	if (region->data != data && region->data && region->data->size)
+		screen->damage_reallocations++;
 }
 
 static void tmbr_screen_on_frame(struct wl_listener *listener, TMBR_UNUSED void *payload)
@@ -813,65 +1960,122 @@ static void tmbr_screen_on_frame(struct wl_listener *listener, TMBR_UNUSED void
 	struct tmbr_screen *screen = wl_container_of(listener, screen, frame);
 	struct wlr_renderer *renderer = wlr_backend_get_renderer(screen->output->backend);
 	struct tmbr_layer_client *layer_client;
-	struct pixman_region32 damage;
+	struct pixman_region32 *damage = &screen->frame_damage;
+	pixman_region32_data_t *frame_data = screen->frame_damage.data, *cursor_data = screen->cursor_damage.data;
 	struct timespec time;
 	bool needs_frame;
 
+	/* Clients of powered off screens neither get rendered nor receive frame callbacks */
+	if (!screen->output->enabled)
+		return;
+	if (screen->mirror) {
+		tmbr_screen_render_mirror(screen);
+		return;
+	}
+
 	clock_gettime(CLOCK_MONOTONIC, &time);
-	pixman_region32_init(&damage);
 
-	tmbr_tree_for_each(screen->focus->clients, tree)
-		if (tree->client->pending_serial)
-			goto out;
+	/*
+	 * Interactive resizes are only applied once all clients have
+	 * acknowledged their previous configure. Like this, clients get at
+	 * most one configure per frame and keep showing their old buffers
+	 * until they have caught up.
+	 */
+	if (screen->focus->resize_pending && !tmbr_desktop_is_configuring(screen->focus)) {
+		screen->focus->resize_pending = false;
+		tmbr_desktop_recalculate(screen->focus);
+	}
+	if (tmbr_desktop_is_configuring(screen->focus)) {
+		if (screen->focus->resize_pending)
+			wlr_output_schedule_frame(screen->output);
+		goto out;
+	}
 
-	if (!wlr_output_damage_attach_render(screen->damage, &needs_frame, &damage))
+	/*
+	 * Clients asking for asynchronous presentation get their buffer
+	 * committed directly without being composited. wlroots does not
+	 * expose tearing page flips, so the flip itself still happens at
+	 * vblank. We fall back to compositing if the buffer cannot be
+	 * scanned out.
+	 */
+	if (tmbr_screen_wants_async(screen) && tmbr_screen_scan_out(screen, screen->focus->focus)) {
+		screen->scanout = true;
+		tmbr_screen_on_present(screen);
+		goto out;
+	} else if (screen->scanout) {
+		wlr_output_damage_add_whole(screen->damage);
+		screen->scanout = false;
+	}
+
+	if (!wlr_output_damage_attach_render(screen->damage, &needs_frame, damage))
 		goto out;
 	if (needs_frame) {
 		wlr_renderer_begin(renderer, screen->output->width, screen->output->height);
 
-		if (!screen->focus->focus && wl_list_empty(&screen->layer_clients)) {
+		if (tmbr_screen_restore_save_under(screen, damage)) {
+			damage = &screen->cursor_damage;
+		} else if (screen->overview) {
+			tmbr_screen_render_overview(screen, damage);
+		} else if (!screen->focus->focus && wl_list_empty(&screen->layer_clients) &&
+			   wl_list_empty(&screen->server->xwayland_unmanaged)) {
 			wlr_renderer_clear(renderer, (float[4]){0.3, 0.3, 0.3, 1.0});
-		} else if (pixman_region32_not_empty(&damage)) {
+		} else if (pixman_region32_not_empty(damage)) {
 			struct pixman_box32 *rects;
 			int i, nrects;
 
-			for (i = 0, rects = pixman_region32_rectangles(&damage, &nrects); i < nrects; i++) {
+			for (i = 0, rects = pixman_region32_rectangles(damage, &nrects); i < nrects; i++) {
 				wlr_renderer_scissor(renderer, &tmbr_box_from_pixman(rects[i]));
 				wlr_renderer_clear(renderer, (float[4]){0.3, 0.3, 0.3, 1.0});
 			}
 
 			if (screen->focus->fullscreen) {
-				tmbr_xdg_client_render(screen->focus->focus, &damage);
+				tmbr_xdg_client_render(screen->focus->focus, damage);
 			} else {
-				tmbr_screen_render_layer(screen, &damage, ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND);
-				tmbr_screen_render_layer(screen, &damage, ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM);
+				tmbr_screen_render_layer(screen, damage, ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND);
+				tmbr_screen_render_layer(screen, damage, ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM);
 				tmbr_tree_for_each(screen->focus->clients, tree)
-					tmbr_xdg_client_render(tree->client, &damage);
-				tmbr_screen_render_layer(screen, &damage, ZWLR_LAYER_SHELL_V1_LAYER_TOP);
+					tmbr_xdg_client_render(tree->client, damage);
+				tmbr_screen_render_layer(screen, damage, ZWLR_LAYER_SHELL_V1_LAYER_TOP);
 			}
-			tmbr_screen_render_layer(screen, &damage, ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY);
+#if WLR_HAS_XWAYLAND
+			tmbr_screen_render_unmanaged(screen, damage);
+#endif
+			tmbr_screen_render_layer(screen, damage, ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY);
 		}
 
 		wlr_renderer_scissor(renderer, NULL);
-		wlr_output_render_software_cursors(screen->output, &damage);
+		tmbr_screen_save_under(screen, damage);
+		screen->scene_damaged = false;
+		wlr_output_render_software_cursors(screen->output, damage);
+		if (screen->readback.enabled && !tmbr_screen_is_mirrored(screen))
+			screen->readback.enabled = false;
+		if (screen->readback.enabled)
+			tmbr_screen_read_back(screen);
 		wlr_renderer_end(renderer);
 		wlr_output_set_damage(screen->output, &screen->damage->current);
-		wlr_output_commit(screen->output);
+		if (wlr_output_commit(screen->output))
+			tmbr_screen_on_present(screen);
+		tmbr_screen_count_damage_reallocation(screen, &screen->frame_damage, frame_data);
+		tmbr_screen_count_damage_reallocation(screen, &screen->cursor_damage, cursor_data);
+		screen->frames++;
 	} else {
 		wlr_output_rollback(screen->output);
 	}
 
 out:
 	tmbr_tree_for_each(screen->focus->clients, tree)
-		wlr_xdg_surface_for_each_surface(tree->client->surface, tmbr_surface_send_frame_done, &time);
+		tmbr_xdg_client_for_each_surface(tree->client, tmbr_surface_send_frame_done, &time);
 	wl_list_for_each(layer_client, &screen->layer_clients, link)
 		wlr_layer_surface_v1_for_each_surface(layer_client->surface, tmbr_surface_send_frame_done, &time);
-	pixman_region32_fini(&damage);
+#if WLR_HAS_XWAYLAND
+	tmbr_screen_send_unmanaged_frame_done(screen, &time);
+#endif
 }
 
 static void tmbr_layer_client_damage_whole(struct tmbr_layer_client *c)
 {
 	wlr_output_damage_add_box(c->screen->damage, &tmbr_box_scaled(c->x, c->y, c->w, c->h, c->screen->output->scale));
+	c->screen->scene_damaged = true;
 }
 
 static void tmbr_screen_recalculate_layers(struct tmbr_screen *s, bool exclusive)
@@ -983,23 +2187,287 @@ static void tmbr_screen_recalculate(struct tmbr_screen *s)
 		tmbr_desktop_recalculate(d);
 }
 
+static void tmbr_parked_screen_free(struct tmbr_parked_screen *parked)
+{
+	wl_event_source_remove(parked->timer);
+	wl_list_remove(&parked->link);
+	free(parked->name);
+	free(parked);
+}
+
+static void tmbr_parked_screen_restore(struct tmbr_parked_screen *parked, struct tmbr_screen *screen)
+{
+	struct tmbr_desktop *desktop, *tmp;
+	wl_list_for_each_safe(desktop, tmp, &parked->desktops, link)
+		tmbr_screen_add_desktop(screen, desktop);
+	tmbr_screen_recalculate(screen);
+	tmbr_parked_screen_free(parked);
+}
+
+static int tmbr_parked_screen_on_timeout(void *payload)
+{
+	struct tmbr_parked_screen *parked = payload;
+	struct tmbr_screen *screen = parked->server->focussed_screen;
+	struct tmbr_desktop *focus = screen->focus;
+	tmbr_parked_screen_restore(parked, screen);
+	tmbr_screen_focus_desktop(screen, focus);
+	return 0;
+}
+
+static void tmbr_screen_park(struct tmbr_screen *screen, struct tmbr_screen *sibling)
+{
+	struct tmbr_parked_screen *parked = tmbr_alloc(sizeof(*parked), "Could not allocate parked screen");
+	struct tmbr_server *server = screen->server;
+	struct tmbr_xdg_client *focus = tmbr_server_find_focus(server);
+	struct tmbr_desktop *desktop;
+
+	if ((parked->name = strdup(screen->output->name)) == NULL)
+		die("Could not allocate parked screen name");
+	parked->server = server;
+	parked->focus = screen->focus;
+	wl_list_init(&parked->desktops);
+	wl_list_insert_list(&parked->desktops, &screen->desktops);
+	wl_list_init(&screen->desktops);
+	wl_list_for_each(desktop, &parked->desktops, link)
+		tmbr_desktop_set_screen(desktop, NULL);
+
+	/*
+	 * Desktops keep their layout while parked so that an output which
+	 * comes back within the grace period does not reconfigure any client.
+	 */
+	parked->timer = wl_event_loop_add_timer(wl_display_get_event_loop(server->display), tmbr_parked_screen_on_timeout, parked);
+	wl_event_source_timer_update(parked->timer, TMBR_SCREEN_HOTPLUG_GRACE);
+	wl_list_insert(&server->parked_screens, &parked->link);
+
+	if (server->focussed_screen == screen) {
+		if (focus)
+			tmbr_xdg_client_focus(focus, false);
+		wlr_seat_pointer_notify_clear_focus(server->seat);
+		wlr_seat_keyboard_notify_clear_focus(server->seat);
+		tmbr_screen_focus_desktop(sibling, sibling->focus);
+	}
+}
+
+static void tmbr_screen_set_mirror(struct tmbr_screen *screen, struct tmbr_screen *source)
+{
+	struct tmbr_server *server = screen->server;
+
+	if (source && !screen->mirror) {
+		struct tmbr_desktop *desktop, *tmp, *focus = source->focus;
+		struct tmbr_layer_client *c, *ctmp;
+
+		wl_list_for_each_safe(desktop, tmp, &screen->desktops, link)
+			tmbr_screen_add_desktop(source, desktop);
+		wl_list_init(&screen->desktops);
+		screen->focus = NULL;
+		tmbr_screen_focus_desktop(source, focus);
+		tmbr_screen_recalculate(source);
+
+		wl_list_for_each_safe(c, ctmp, &screen->layer_clients, link)
+			wlr_layer_surface_v1_close(c->surface);
+		wlr_output_layout_remove(server->output_layout, screen->output);
+	} else if (!source && screen->mirror) {
+		screen->mirror = NULL;
+		wlr_output_layout_add_auto(server->output_layout, screen->output);
+		tmbr_screen_add_desktop(screen, tmbr_desktop_new());
+		tmbr_screen_recalculate(screen);
+	}
+
+	screen->mirror = source;
+	wlr_output_damage_add_whole(screen->damage);
+}
+
+/*
+ * Screens whose output got disabled via an output configuration hand their
+ * desktops over to a sibling, the same as if it had been unplugged. They
+ * only stay put if there is no other screen to take them.
+ */
+static void tmbr_screen_set_disabled(struct tmbr_screen *screen, bool disabled)
+{
+	struct tmbr_desktop *desktop, *tmp, *focus;
+	struct tmbr_screen *sibling;
+
+	if (screen->disabled == disabled || screen->mirror)
+		return;
+
+	if (!disabled) {
+		screen->disabled = false;
+		if (!screen->focus)
+			tmbr_screen_add_desktop(screen, tmbr_desktop_new());
+		tmbr_screen_recalculate(screen);
+		return;
+	}
+
+	if ((sibling = tmbr_screen_find_sibling(screen, TMBR_CTRL_SELECTION_NEXT)) != NULL) {
+		focus = sibling->focus;
+		wl_list_for_each_safe(desktop, tmp, &screen->desktops, link)
+			tmbr_screen_add_desktop(sibling, desktop);
+		wl_list_init(&screen->desktops);
+		screen->focus = NULL;
+		tmbr_screen_focus_desktop(sibling, focus);
+		tmbr_screen_recalculate(sibling);
+	}
+	screen->disabled = true;
+}
+
+static void tmbr_screen_on_destroy(struct wl_listener *listener, TMBR_UNUSED void *payload)
+{
+	struct tmbr_screen *screen = wl_container_of(listener, screen, destroy), *sibling, *s;
+	struct tmbr_layer_client *c, *ctmp;
+	struct tmbr_desktop *desktop;
+	size_t i;
+
+	wl_list_for_each(s, &screen->server->screens, link)
+		if (s->mirror == screen)
+			tmbr_screen_set_mirror(s, NULL);
+
+	/*
+	 * Only screens which own desktops get parked. Mirrors, disabled and
+	 * killed screens have already handed theirs over to a sibling.
+	 */
+	if ((sibling = tmbr_screen_find_sibling(screen, TMBR_CTRL_SELECTION_NEXT)) != NULL) {
+		if (!screen->mirror && screen->focus)
+			tmbr_screen_park(screen, sibling);
+		else if (screen->server->focussed_screen == screen)
+			tmbr_screen_focus_desktop(sibling, sibling->focus);
+	} else {
+		wl_list_for_each(desktop, &screen->desktops, link) {
+			tmbr_tree_for_each(desktop->clients, t)
+				tmbr_desktop_remove_client(desktop, t->client);
+		}
+		wl_display_terminate(screen->server->display);
+	}
+	wl_list_for_each_safe(c, ctmp, &screen->layer_clients, link)
+		wlr_layer_surface_v1_close(c->surface);
+
+	tmbr_unregister(&screen->destroy, &screen->frame, &screen->mode, &screen->commit, NULL);
+	wl_list_remove(&screen->link);
+	pixman_region32_fini(&screen->frame_damage);
+	pixman_region32_fini(&screen->surface_damage);
+	pixman_region32_fini(&screen->cursor_damage);
+	for (i = 0; i < ARRAY_SIZE(screen->save_under); i++)
+		if (screen->save_under[i].texture)
+			wlr_texture_destroy(screen->save_under[i].texture);
+	free(screen->save_under_pixels);
+	if (screen->readback.texture)
+		wlr_texture_destroy(screen->readback.texture);
+	free(screen->readback.pixels);
+	free(screen);
+}
+
 static void tmbr_screen_on_mode(struct wl_listener *listener, TMBR_UNUSED void *payload)
 {
 	struct tmbr_screen *screen = wl_container_of(listener, screen, mode);
 	tmbr_screen_recalculate(screen);
 }
 
+/*
+ * Helper threads perform blocking work off the event loop and must not
+ * compete with the realtime main thread.
+ */
+static int tmbr_thread_create(pthread_t *thread, void *(*fn)(void *), void *payload)
+{
+	struct sched_param param = { .sched_priority = 0 };
+	pthread_attr_t attr;
+	int err;
+
+	if ((err = pthread_attr_init(&attr)) != 0)
+		return err;
+	if ((err = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED)) == 0 &&
+	    (err = pthread_attr_setschedpolicy(&attr, SCHED_OTHER)) == 0 &&
+	    (err = pthread_attr_setschedparam(&attr, &param)) == 0)
+		err = pthread_create(thread, &attr, fn, payload);
+	pthread_attr_destroy(&attr);
+	return err;
+}
+
+static void tmbr_thread_setup(void)
+{
+	sigset_t set;
+
+	/* Signals are handled by the event loop of the main thread only */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	/* Nice values are per thread and inherited, so drop a raised priority of the main thread */
+	if (getpriority(PRIO_PROCESS, 0) < 0)
+		setpriority(PRIO_PROCESS, 0, 0);
+}
+
+static void *tmbr_xcursor_load_thread(void *payload)
+{
+	struct tmbr_xcursor_load *load = payload;
+
+	tmbr_thread_setup();
+	load->theme = wlr_xcursor_theme_load(load->server->xcursor->name, load->server->xcursor->size * load->scale);
+	close(load->fds[1]);
+	return NULL;
+}
+
+static void tmbr_xcursor_load_free(struct tmbr_xcursor_load *load)
+{
+	wl_event_source_remove(load->source);
+	wl_list_remove(&load->link);
+	close(load->fds[0]);
+	free(load);
+}
+
+static int tmbr_xcursor_load_on_done(TMBR_UNUSED int fd, TMBR_UNUSED uint32_t mask, void *payload)
+{
+	struct tmbr_xcursor_load *load = payload;
+	struct tmbr_server *server = load->server;
+
+	pthread_join(load->thread, NULL);
+	if (load->theme) {
+		struct wlr_xcursor_manager_theme *theme = tmbr_alloc(sizeof(*theme), "Could not allocate cursor theme");
+		theme->scale = load->scale;
+		theme->theme = load->theme;
+		wl_list_insert(&server->xcursor->scaled_themes, &theme->link);
+		if (!server->seat->pointer_state.focused_surface)
+			wlr_xcursor_manager_set_cursor_image(server->xcursor, "left_ptr", server->cursor);
+	} else {
+		wlr_log(WLR_ERROR, "Could not load cursor theme at scale %.2f", load->scale);
+	}
+
+	tmbr_xcursor_load_free(load);
+	return 0;
+}
+
+static void tmbr_xcursor_load(struct tmbr_server *server, float scale)
+{
+	struct wlr_xcursor_manager_theme *theme;
+	struct tmbr_xcursor_load *load;
+
+	wl_list_for_each(theme, &server->xcursor->scaled_themes, link)
+		if (theme->scale == scale)
+			return;
+	wl_list_for_each(load, &server->xcursor_loads, link)
+		if (load->scale == scale)
+			return;
+
+	load = tmbr_alloc(sizeof(*load), "Could not allocate cursor theme loader");
+	load->server = server;
+	load->scale = scale;
+	if (pipe2(load->fds, O_CLOEXEC) < 0)
+		die("Could not create cursor theme pipe: %s", strerror(errno));
+	if ((errno = tmbr_thread_create(&load->thread, tmbr_xcursor_load_thread, load)) != 0)
+		die("Could not spawn cursor theme loader: %s", strerror(errno));
+	load->source = wl_event_loop_add_fd(wl_display_get_event_loop(server->display), load->fds[0],
+					    WL_EVENT_READABLE, tmbr_xcursor_load_on_done, load);
+	wl_list_insert(&server->xcursor_loads, &load->link);
+}
+
 static void tmbr_screen_on_commit(struct wl_listener *listener, TMBR_UNUSED void *payload)
 {
 	struct tmbr_screen *screen = wl_container_of(listener, screen, commit);
 #if WLR_VERSION_MAJOR > 0 || WLR_VERSION_MINOR >= 13
 	struct wlr_output_event_commit *event = payload;
 	if (event->committed & WLR_OUTPUT_STATE_SCALE)
-		wlr_xcursor_manager_load(screen->server->xcursor, screen->output->scale);
+		tmbr_xcursor_load(screen->server, screen->output->scale);
 	if (event->committed & (WLR_OUTPUT_STATE_TRANSFORM|WLR_OUTPUT_STATE_SCALE))
 		tmbr_screen_recalculate(screen);
 #else
-	wlr_xcursor_manager_load(screen->server->xcursor, screen->output->scale);
+	tmbr_xcursor_load(screen->server, screen->output->scale);
 	tmbr_screen_recalculate(screen);
 #endif
 }
@@ -1007,14 +2475,29 @@ static void tmbr_screen_on_commit(struct wl_listener *listener, TMBR_UNUSED void
 static struct tmbr_screen *tmbr_screen_new(struct tmbr_server *server, struct wlr_output *output)
 {
 	struct tmbr_screen *screen = tmbr_alloc(sizeof(*screen), "Could not allocate screen");
+	struct tmbr_parked_screen *parked;
+	struct tmbr_desktop *focus;
 	screen->output = output;
 	screen->server = server;
 	screen->damage = wlr_output_damage_create(output);
+	pixman_region32_init(&screen->frame_damage);
+	pixman_region32_init(&screen->surface_damage);
+	pixman_region32_init(&screen->cursor_damage);
 	wl_list_init(&screen->desktops);
 	wl_list_init(&screen->layer_clients);
 	tmbr_screen_recalculate(screen);
 
-	tmbr_screen_add_desktop(screen, tmbr_desktop_new());
+	wl_list_for_each(parked, &server->parked_screens, link) {
+		if (strcmp(parked->name, output->name))
+			continue;
+		focus = parked->focus;
+		tmbr_parked_screen_restore(parked, screen);
+		if (focus)
+			tmbr_screen_focus_desktop(screen, focus);
+		break;
+	}
+	if (!screen->focus)
+		tmbr_screen_add_desktop(screen, tmbr_desktop_new());
 	tmbr_register(&output->events.destroy, &screen->destroy, tmbr_screen_on_destroy);
 	tmbr_register(&output->events.mode, &screen->mode, tmbr_screen_on_mode);
 #if WLR_VERSION_MAJOR == 0 && WLR_VERSION_MINOR < 13
@@ -1045,6 +2528,7 @@ static void tmbr_keyboard_on_key(struct wl_listener *listener, void *payload)
 	int i, n;
 
 	wlr_idle_notify_activity(keyboard->server->idle, keyboard->server->seat);
+	tmbr_server_stamp_input(keyboard->server, event->time_msec);
 	if (event->state != WL_KEYBOARD_KEY_STATE_PRESSED || keyboard->server->input_inhibit->active_client)
 		goto unhandled;
 
@@ -1152,6 +2636,173 @@ static struct tmbr_screen *tmbr_server_find_output(struct tmbr_server *server, c
 	return NULL;
 }
 
+static struct wlr_output_configuration_head_v1 *tmbr_server_add_output_configuration(struct tmbr_server *server, struct wlr_output_configuration_v1 *cfg, struct wlr_output *output)
+{
+	struct wlr_output_configuration_head_v1 *head;
+	struct wlr_box *box;
+
+	wl_list_for_each(head, &cfg->heads, link)
+		if (head->state.output == output)
+			return head;
+
+	if ((head = wlr_output_configuration_head_v1_create(cfg, output)) == NULL)
+		die("Could not allocate output configuration head");
+	if ((box = wlr_output_layout_get_box(server->output_layout, output)) != NULL) {
+		head->state.x = box->x;
+		head->state.y = box->y;
+	}
+	return head;
+}
+
+static void tmbr_output_state_save(struct tmbr_output_state *state, struct wlr_output *output)
+{
+	state->output = output;
+	state->enabled = output->enabled;
+	state->mode = output->current_mode;
+	state->width = output->width;
+	state->height = output->height;
+	state->refresh = output->refresh;
+	state->scale = output->scale;
+	state->transform = output->transform;
+}
+
+static void tmbr_output_state_restore(struct tmbr_output_state *state)
+{
+	wlr_output_enable(state->output, state->enabled);
+	if (state->enabled) {
+		if (state->mode)
+			wlr_output_set_mode(state->output, state->mode);
+		else
+			wlr_output_set_custom_mode(state->output, state->width, state->height, state->refresh);
+		wlr_output_set_scale(state->output, state->scale);
+		wlr_output_set_transform(state->output, state->transform);
+	}
+	if (!wlr_output_commit(state->output))
+		wlr_log(WLR_ERROR, "Could not restore configuration of output %s", state->output->name);
+}
+
+static bool tmbr_server_apply_output_configuration(struct tmbr_server *server, struct wlr_output_configuration_v1 *cfg, bool test_only)
+{
+	struct tmbr_output_state *states = tmbr_alloc(wl_list_length(&cfg->heads) * sizeof(*states), "Could not allocate output states");
+	struct wlr_output_configuration_head_v1 *head;
+	size_t i, ncommitted = 0;
+	bool ok = true;
+
+	/*
+	 * All outputs get tested before any of them is committed so that
+	 * the configuration is applied either completely or not at all.
+	 * Outputs which were already committed when a later commit fails
+	 * get reverted to their previous state.
+	 */
+	i = 0;
+	wl_list_for_each(head, &cfg->heads, link) {
+		struct wlr_output *output = head->state.output;
+
+		tmbr_output_state_save(&states[i++], output);
+		wlr_output_enable(output, head->state.enabled);
+		if (head->state.enabled) {
+			if (head->state.mode)
+				wlr_output_set_mode(output, head->state.mode);
+			else if (head->state.custom_mode.width && head->state.custom_mode.height)
+				wlr_output_set_custom_mode(output, head->state.custom_mode.width, head->state.custom_mode.height,
+							   head->state.custom_mode.refresh);
+			wlr_output_set_scale(output, head->state.scale);
+			wlr_output_set_transform(output, head->state.transform);
+		}
+
+		if (!wlr_output_test(output)) {
+			ok = false;
+			break;
+		}
+	}
+
+	wl_list_for_each(head, &cfg->heads, link) {
+		struct wlr_output *output = head->state.output;
+
+		if (!ok || test_only) {
+			wlr_output_rollback(output);
+		} else if (!wlr_output_commit(output)) {
+			wlr_log(WLR_ERROR, "Could not commit configuration of output %s", output->name);
+			wlr_output_rollback(output);
+			ok = false;
+		} else {
+			ncommitted++;
+		}
+	}
+
+	if (!ok) {
+		for (i = 0; i < ncommitted; i++)
+			tmbr_output_state_restore(&states[i]);
+	} else if (!test_only) {
+		/*
+		 * Outputs whose position did not change stay where they are,
+		 * which keeps auto-placed outputs auto-placed. Mirrors are
+		 * never part of the layout.
+		 */
+		wl_list_for_each(head, &cfg->heads, link) {
+			struct tmbr_screen *screen = head->state.output->data;
+			struct wlr_box *box = wlr_output_layout_get_box(server->output_layout, head->state.output);
+
+			if (screen && screen->mirror)
+				continue;
+			if (!head->state.enabled)
+				wlr_output_layout_remove(server->output_layout, head->state.output);
+			else if (!box || box->x != head->state.x || box->y != head->state.y)
+				wlr_output_layout_add(server->output_layout, head->state.output, head->state.x, head->state.y);
+			if (screen)
+				tmbr_screen_set_disabled(screen, !head->state.enabled);
+		}
+	}
+
+	free(states);
+	return ok;
+}
+
+static void tmbr_server_on_output_configuration_idle(void *payload)
+{
+	struct tmbr_server *server = payload;
+	struct wlr_output_configuration_v1 *cfg;
+	struct tmbr_screen *s;
+
+	server->output_configuration_idle = NULL;
+	if ((cfg = wlr_output_configuration_v1_create()) == NULL)
+		die("Could not allocate output configuration");
+	wl_list_for_each(s, &server->screens, link)
+		tmbr_server_add_output_configuration(server, cfg, s->output);
+	wlr_output_manager_v1_set_configuration(server->output_manager, cfg);
+}
+
+static void tmbr_server_on_output_layout_change(struct wl_listener *listener, TMBR_UNUSED void *payload)
+{
+	struct tmbr_server *server = wl_container_of(listener, server, output_layout_change);
+	if (!server->output_configuration_idle)
+		server->output_configuration_idle = wl_event_loop_add_idle(wl_display_get_event_loop(server->display),
+									   tmbr_server_on_output_configuration_idle, server);
+}
+
+static void tmbr_server_on_output_manager_apply(struct wl_listener *listener, void *payload)
+{
+	struct tmbr_server *server = wl_container_of(listener, server, output_manager_apply);
+	struct wlr_output_configuration_v1 *cfg = payload;
+	if (tmbr_server_apply_output_configuration(server, cfg, false))
+		wlr_output_configuration_v1_send_succeeded(cfg);
+	else
+		wlr_output_configuration_v1_send_failed(cfg);
+	wlr_output_configuration_v1_destroy(cfg);
+	tmbr_server_on_output_layout_change(&server->output_layout_change, NULL);
+}
+
+static void tmbr_server_on_output_manager_test(struct wl_listener *listener, void *payload)
+{
+	struct tmbr_server *server = wl_container_of(listener, server, output_manager_test);
+	struct wlr_output_configuration_v1 *cfg = payload;
+	if (tmbr_server_apply_output_configuration(server, cfg, true))
+		wlr_output_configuration_v1_send_succeeded(cfg);
+	else
+		wlr_output_configuration_v1_send_failed(cfg);
+	wlr_output_configuration_v1_destroy(cfg);
+}
+
 static void tmbr_server_on_new_input(struct wl_listener *listener, void *payload)
 {
 	struct tmbr_server *server = wl_container_of(listener, server, new_input);
@@ -1174,60 +2825,428 @@ static void tmbr_server_on_new_input(struct wl_listener *listener, void *payload
 	wlr_seat_set_capabilities(server->seat, WL_SEAT_CAPABILITY_POINTER|WL_SEAT_CAPABILITY_KEYBOARD);
 }
 
-static void tmbr_server_on_new_output(struct wl_listener *listener, void *payload)
+static void tmbr_server_on_new_output(struct wl_listener *listener, void *payload)
+{
+	struct tmbr_server *server = wl_container_of(listener, server, new_output);
+	struct wlr_output *output = payload;
+	struct wlr_output_mode *mode;
+	struct tmbr_screen *screen;
+
+	wlr_output_enable(output, true);
+	if (server->headless_refresh && wlr_output_is_headless(output))
+		wlr_output_set_custom_mode(output, output->width, output->height, server->headless_refresh);
+	else if ((mode = wlr_output_preferred_mode(output)) != NULL)
+		wlr_output_set_mode(output, mode);
+	wlr_output_layout_add_auto(server->output_layout, output);
+	if (!wlr_output_commit(output))
+		return;
+
+	tmbr_xcursor_load(server, output->scale);
+	screen = tmbr_screen_new(server, output);
+	wl_list_insert(&server->screens, &screen->link);
+	if (!server->focussed_screen)
+		server->focussed_screen = screen;
+	output->data = screen;
+}
+
+static void tmbr_xdg_client_on_set_title(struct wl_listener *listener, TMBR_UNUSED void *payload)
+{
+	struct tmbr_xdg_client *client = wl_container_of(listener, client, set_title);
+	if (client->toplevel_handle && tmbr_xdg_client_get_title(client))
+		wlr_foreign_toplevel_handle_v1_set_title(client->toplevel_handle, tmbr_xdg_client_get_title(client));
+}
+
+static void tmbr_xdg_client_on_set_app_id(struct wl_listener *listener, TMBR_UNUSED void *payload)
+{
+	struct tmbr_xdg_client *client = wl_container_of(listener, client, set_app_id);
+	if (client->toplevel_handle && tmbr_xdg_client_get_app_id(client))
+		wlr_foreign_toplevel_handle_v1_set_app_id(client->toplevel_handle, tmbr_xdg_client_get_app_id(client));
+}
+
+static void tmbr_xdg_client_on_toplevel_activate(struct wl_listener *listener, TMBR_UNUSED void *payload)
+{
+	struct tmbr_xdg_client *client = wl_container_of(listener, client, toplevel_activate), *focus;
+	if (!client->desktop || !client->desktop->screen)
+		return;
+	if ((focus = tmbr_server_find_focus(client->server)) != NULL && focus != client)
+		tmbr_xdg_client_focus(focus, false);
+	tmbr_desktop_focus_client(client->desktop, client, false);
+	tmbr_screen_focus_desktop(client->desktop->screen, client->desktop);
+}
+
+static void tmbr_xdg_client_on_toplevel_close(struct wl_listener *listener, TMBR_UNUSED void *payload)
+{
+	struct tmbr_xdg_client *client = wl_container_of(listener, client, toplevel_close);
+	tmbr_xdg_client_kill(client);
+}
+
+static void tmbr_xdg_client_on_toplevel_fullscreen(struct wl_listener *listener, void *payload)
+{
+	struct wlr_foreign_toplevel_handle_v1_fullscreen_event *event = payload;
+	struct tmbr_xdg_client *client = wl_container_of(listener, client, toplevel_fullscreen);
+	if (client->desktop && client == client->desktop->focus)
+		tmbr_desktop_set_fullscreen(client->desktop, event->fullscreen);
+}
+
+static void tmbr_xdg_client_publish(struct tmbr_xdg_client *client)
+{
+	if ((client->toplevel_handle = wlr_foreign_toplevel_handle_v1_create(client->server->foreign_toplevel)) == NULL)
+		die("Could not create toplevel handle");
+	tmbr_register(&client->toplevel_handle->events.request_activate, &client->toplevel_activate, tmbr_xdg_client_on_toplevel_activate);
+	tmbr_register(&client->toplevel_handle->events.request_close, &client->toplevel_close, tmbr_xdg_client_on_toplevel_close);
+	tmbr_register(&client->toplevel_handle->events.request_fullscreen, &client->toplevel_fullscreen, tmbr_xdg_client_on_toplevel_fullscreen);
+	tmbr_xdg_client_on_set_title(&client->set_title, NULL);
+	tmbr_xdg_client_on_set_app_id(&client->set_app_id, NULL);
+}
+
+static void tmbr_xdg_client_unpublish(struct tmbr_xdg_client *client)
+{
+	if (!client->toplevel_handle)
+		return;
+	tmbr_unregister(&client->toplevel_activate, &client->toplevel_close, &client->toplevel_fullscreen, NULL);
+	wlr_foreign_toplevel_handle_v1_destroy(client->toplevel_handle);
+	client->toplevel_handle = NULL;
+}
+
+static void tmbr_server_on_request_fullscreen(struct wl_listener *listener, void *payload)
+{
+	struct wlr_xdg_toplevel_set_fullscreen_event *event = payload;
+	struct tmbr_xdg_client *client = wl_container_of(listener, client, request_fullscreen);
+	if (client->desktop && client == tmbr_server_find_focus(client->server))
+		tmbr_desktop_set_fullscreen(client->desktop, event->fullscreen);
+}
+
+static void tmbr_server_on_map(struct wl_listener *listener, TMBR_UNUSED void *payload)
+{
+	struct tmbr_xdg_client *client = wl_container_of(listener, client, map);
+	tmbr_xdg_client_resolve_pid(client);
+	tmbr_xdg_client_publish(client);
+	tmbr_desktop_add_client(client->server->focussed_screen->focus, client);
+	tmbr_desktop_focus_client(client->server->focussed_screen->focus, client, true);
+}
+
+static void tmbr_server_on_unmap(struct wl_listener *listener, TMBR_UNUSED void *payload)
+{
+	struct tmbr_xdg_client *client = wl_container_of(listener, client, unmap);
+	if (client->desktop)
+		tmbr_desktop_remove_client(client->desktop, client);
+	tmbr_xdg_client_set_priority(client, true);
+	tmbr_xdg_client_release_pid(client);
+	tmbr_xdg_client_unpublish(client);
+}
+
+static void tmbr_server_on_new_surface(struct wl_listener *listener, void *payload)
+{
+	struct tmbr_server *server = wl_container_of(listener, server, new_surface);
+	struct wlr_xdg_surface *surface = payload;
+
+	if (surface->role == WLR_XDG_SURFACE_ROLE_TOPLEVEL) {
+		struct tmbr_xdg_client *client = tmbr_xdg_client_new(server, surface);
+		tmbr_register(&surface->events.map, &client->map, tmbr_server_on_map);
+		tmbr_register(&surface->events.unmap, &client->unmap, tmbr_server_on_unmap);
+		tmbr_register(&surface->toplevel->events.request_fullscreen, &client->request_fullscreen, tmbr_server_on_request_fullscreen);
+		tmbr_register(&surface->toplevel->events.set_title, &client->set_title, tmbr_xdg_client_on_set_title);
+		tmbr_register(&surface->toplevel->events.set_app_id, &client->set_app_id, tmbr_xdg_client_on_set_app_id);
+	}
+}
+
+#if WLR_HAS_XWAYLAND
+static void tmbr_xwayland_release(struct tmbr_server *server)
+{
+	if (--server->xwayland_surfaces == 0 && TMBR_XWAYLAND_IDLE_TIMEOUT)
+		wl_event_source_timer_update(server->xwayland_idle, TMBR_XWAYLAND_IDLE_TIMEOUT);
+}
+
+static pid_t tmbr_xwayland_get_pid(struct tmbr_server *server)
+{
+#if WLR_VERSION_MAJOR == 0 && WLR_VERSION_MINOR < 12
+	return server->xwayland->pid;
+#else
+	return server->xwayland->server ? server->xwayland->server->pid : 0;
+#endif
+}
+
+/*
+ * Count the clients connected to the X server via the X-Resource
+ * extension. Both the window manager of wlroots and the connection used
+ * for the query belong to our own process and are thus identified via
+ * their PID. Returns a negative value if the X server could not be asked.
+ */
+static int tmbr_xwayland_count_clients(const char *display)
+{
+	xcb_res_client_id_spec_t spec = { .client = 0, .mask = XCB_RES_CLIENT_ID_MASK_LOCAL_CLIENT_PID };
+	xcb_connection_t *conn = xcb_connect(display, NULL);
+	xcb_res_query_client_ids_reply_t *reply;
+	xcb_res_client_id_value_iterator_t it;
+	int clients = -1;
+
+	if (xcb_connection_has_error(conn) ||
+	    (reply = xcb_res_query_client_ids_reply(conn, xcb_res_query_client_ids(conn, 1, &spec), NULL)) == NULL)
+		goto out;
+	for (clients = 0, it = xcb_res_query_client_ids_ids_iterator(reply); it.rem; xcb_res_client_id_value_next(&it))
+		if (xcb_res_client_id_value_value_length(it.data) != 1 ||
+		    *xcb_res_client_id_value_value(it.data) != (uint32_t) getpid())
+			clients++;
+	free(reply);
+out:
+	xcb_disconnect(conn);
+	return clients;
+}
+
+static void *tmbr_xwayland_check_thread(void *payload)
+{
+	struct tmbr_xwayland_check *check = payload;
+
+	tmbr_thread_setup();
+	check->clients = tmbr_xwayland_count_clients(check->display);
+	close(check->fds[1]);
+	return NULL;
+}
+
+static void tmbr_xwayland_check_free(struct tmbr_xwayland_check *check)
+{
+	check->server->xwayland_check = NULL;
+	wl_event_source_remove(check->source);
+	close(check->fds[0]);
+	free(check);
+}
+
+static int tmbr_xwayland_check_on_done(TMBR_UNUSED int fd, TMBR_UNUSED uint32_t mask, void *payload)
+{
+	struct tmbr_xwayland_check *check = payload;
+	struct tmbr_server *server = check->server;
+
+	pthread_join(check->thread, NULL);
+
+	/* Windows may have been created or the X server restarted while the check was running */
+	if (!server->xwayland_surfaces && check->pid == tmbr_xwayland_get_pid(server)) {
+		if (check->clients == 0)
+			kill(check->pid, SIGTERM);
+		else
+			wl_event_source_timer_update(server->xwayland_idle, TMBR_XWAYLAND_IDLE_TIMEOUT);
+	}
+
+	tmbr_xwayland_check_free(check);
+	return 0;
+}
+
+static int tmbr_xwayland_on_idle(void *payload)
+{
+	struct tmbr_server *server = payload;
+	struct tmbr_xwayland_check *check;
+	pid_t pid = tmbr_xwayland_get_pid(server);
+
+	/*
+	 * wlroots restarts the X server lazily after it has exited, so the
+	 * next X11 client connecting to the socket will spawn it anew.
+	 * Clients without any windows still hold a connection to the X
+	 * server, so it is only stopped once nobody is connected anymore.
+	 * Asking the X server happens on a separate thread, as it may in
+	 * turn be waiting for us to answer one of its Wayland requests.
+	 */
+	if (server->xwayland_surfaces || server->xwayland_check || pid <= 0)
+		return 0;
+
+	check = tmbr_alloc(sizeof(*check), "Could not allocate X11 client check");
+	check->server = server;
+	check->pid = pid;
+	snprintf(check->display, sizeof(check->display), "%s", server->xwayland->display_name);
+	if (pipe2(check->fds, O_CLOEXEC) < 0)
+		die("Could not create X11 client check pipe: %s", strerror(errno));
+	if ((errno = tmbr_thread_create(&check->thread, tmbr_xwayland_check_thread, check)) != 0)
+		die("Could not spawn X11 client check: %s", strerror(errno));
+	check->source = wl_event_loop_add_fd(wl_display_get_event_loop(server->display), check->fds[0],
+					     WL_EVENT_READABLE, tmbr_xwayland_check_on_done, check);
+	server->xwayland_check = check;
+	return 0;
+}
+
+static void tmbr_xwayland_unmanaged_damage_whole(struct tmbr_xwayland_unmanaged *u)
+{
+	struct wlr_box box = { u->surface->x, u->surface->y, u->surface->width, u->surface->height };
+	struct tmbr_screen *s;
+	double ox, oy;
+
+	wl_list_for_each(s, &u->server->screens, link) {
+		if (!wlr_output_layout_intersects(u->server->output_layout, s->output, &box))
+			continue;
+		tmbr_screen_get_origin(s, &ox, &oy);
+		wlr_output_damage_add_box(s->damage, &tmbr_box_scaled(box.x - ox, box.y - oy, box.width, box.height, s->output->scale));
+		s->scene_damaged = true;
+	}
+}
+
+static bool tmbr_xwayland_unmanaged_notify_pointer(struct tmbr_server *server)
+{
+	struct tmbr_xwayland_unmanaged *u;
+	struct wlr_surface *surface;
+	struct timespec now;
+	double sx, sy;
+
+	/* Both the cursor and unmanaged surfaces are positioned in layout coordinates */
+	wl_list_for_each(u, &server->xwayland_unmanaged, link) {
+		if ((surface = wlr_surface_surface_at(u->surface->surface, server->cursor->x - u->surface->x,
+						      server->cursor->y - u->surface->y, &sx, &sy)) == NULL)
+			continue;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		wlr_seat_pointer_notify_enter(server->seat, surface, sx, sy);
+		wlr_seat_pointer_notify_motion(server->seat, now.tv_sec * 1000 + now.tv_nsec / 1000000, sx, sy);
+		return true;
+	}
+	return false;
+}
+
+static void tmbr_xwayland_unmanaged_on_commit(struct wl_listener *listener, TMBR_UNUSED void *payload)
+{
+	struct tmbr_xwayland_unmanaged *u = wl_container_of(listener, u, commit);
+	tmbr_xwayland_unmanaged_damage_whole(u);
+}
+
+static void tmbr_xwayland_unmanaged_on_map(struct wl_listener *listener, TMBR_UNUSED void *payload)
+{
+	struct tmbr_xwayland_unmanaged *u = wl_container_of(listener, u, map);
+	struct wlr_keyboard *keyboard = wlr_seat_get_keyboard(u->server->seat);
+
+	wl_list_insert(&u->server->xwayland_unmanaged, &u->link);
+	tmbr_register(&u->surface->surface->events.commit, &u->commit, tmbr_xwayland_unmanaged_on_commit);
+	tmbr_xwayland_unmanaged_damage_whole(u);
+
+	if (keyboard && wlr_xwayland_or_surface_wants_focus(u->surface))
+		wlr_seat_keyboard_notify_enter(u->server->seat, u->surface->surface, keyboard->keycodes,
+					       keyboard->num_keycodes, &keyboard->modifiers);
+}
+
+static void tmbr_xwayland_unmanaged_on_unmap(struct wl_listener *listener, TMBR_UNUSED void *payload)
+{
+	struct tmbr_xwayland_unmanaged *u = wl_container_of(listener, u, unmap);
+	struct tmbr_xdg_client *focus;
+
+	tmbr_xwayland_unmanaged_damage_whole(u);
+	tmbr_unregister(&u->commit, NULL);
+	wl_list_remove(&u->link);
+
+	if (u->server->seat->keyboard_state.focused_surface == u->surface->surface &&
+	    (focus = tmbr_server_find_focus(u->server)) != NULL)
+		tmbr_xdg_client_focus(focus, true);
+}
+
+static void tmbr_xwayland_unmanaged_on_request_configure(struct wl_listener *listener, void *payload)
+{
+	struct tmbr_xwayland_unmanaged *u = wl_container_of(listener, u, request_configure);
+	struct wlr_xwayland_surface_configure_event *event = payload;
+	tmbr_xwayland_unmanaged_damage_whole(u);
+	wlr_xwayland_surface_configure(u->surface, event->x, event->y, event->width, event->height);
+	tmbr_xwayland_unmanaged_damage_whole(u);
+}
+
+static void tmbr_xwayland_unmanaged_on_destroy(struct wl_listener *listener, TMBR_UNUSED void *payload)
+{
+	struct tmbr_xwayland_unmanaged *u = wl_container_of(listener, u, destroy);
+	struct tmbr_server *server = u->server;
+	tmbr_unregister(&u->map, &u->unmap, &u->request_configure, &u->destroy, NULL);
+	free(u);
+	tmbr_xwayland_release(server);
+}
+
+static void tmbr_xwayland_client_on_map(struct wl_listener *listener, void *payload)
+{
+	struct tmbr_xdg_client *client = wl_container_of(listener, client, map);
+	tmbr_register(&client->xsurface->surface->events.commit, &client->commit, tmbr_xdg_client_on_commit);
+	tmbr_xdg_client_set_tiled(client);
+	tmbr_server_on_map(listener, payload);
+}
+
+static void tmbr_xwayland_client_on_unmap(struct wl_listener *listener, void *payload)
+{
+	struct tmbr_xdg_client *client = wl_container_of(listener, client, unmap);
+	tmbr_server_on_unmap(listener, payload);
+	tmbr_unregister(&client->commit, NULL);
+}
+
+static void tmbr_xwayland_client_on_request_configure(struct wl_listener *listener, void *payload)
 {
-	struct tmbr_server *server = wl_container_of(listener, server, new_output);
-	struct wlr_output *output = payload;
-	struct wlr_output_mode *mode;
-	struct tmbr_screen *screen;
-
-	wlr_output_enable(output, true);
-	if ((mode = wlr_output_preferred_mode(output)) != NULL)
-		wlr_output_set_mode(output, mode);
-	wlr_output_layout_add_auto(server->output_layout, output);
-	if (!wlr_output_commit(output))
-		return;
-
-	screen = tmbr_screen_new(server, output);
-	wl_list_insert(&server->screens, &screen->link);
-	if (!server->focussed_screen)
-		server->focussed_screen = screen;
-	output->data = screen;
+	struct tmbr_xdg_client *client = wl_container_of(listener, client, request_configure);
+	struct wlr_xwayland_surface_configure_event *event = payload;
+
+	/* Tiled windows do not get to choose their own geometry */
+	if (client->desktop) {
+		double ox = 0, oy = 0;
+		if (client->desktop->screen)
+			tmbr_screen_get_origin(client->desktop->screen, &ox, &oy);
+		wlr_xwayland_surface_configure(client->xsurface, ox + client->x + client->border, oy + client->y + client->border,
+					       client->w - 2 * client->border, client->h - 2 * client->border);
+	} else
+		wlr_xwayland_surface_configure(client->xsurface, event->x, event->y, event->width, event->height);
 }
 
-static void tmbr_server_on_request_fullscreen(struct wl_listener *listener, void *payload)
+static void tmbr_xwayland_client_on_request_fullscreen(struct wl_listener *listener, TMBR_UNUSED void *payload)
 {
-	struct wlr_xdg_toplevel_set_fullscreen_event *event = payload;
 	struct tmbr_xdg_client *client = wl_container_of(listener, client, request_fullscreen);
 	if (client->desktop && client == tmbr_server_find_focus(client->server))
-		tmbr_desktop_set_fullscreen(client->desktop, event->fullscreen);
+		tmbr_desktop_set_fullscreen(client->desktop, client->xsurface->fullscreen);
 }
 
-static void tmbr_server_on_map(struct wl_listener *listener, TMBR_UNUSED void *payload)
+static void tmbr_xwayland_client_on_destroy(struct wl_listener *listener, TMBR_UNUSED void *payload)
 {
-	struct tmbr_xdg_client *client = wl_container_of(listener, client, map);
-	tmbr_desktop_add_client(client->server->focussed_screen->focus, client);
-	tmbr_desktop_focus_client(client->server->focussed_screen->focus, client, true);
+	struct tmbr_xdg_client *client = wl_container_of(listener, client, destroy);
+	struct tmbr_server *server = client->server;
+	tmbr_unregister(&client->destroy, &client->map, &client->unmap, &client->request_configure,
+			&client->request_fullscreen, &client->set_title, &client->set_app_id, NULL);
+	free(client);
+	tmbr_xwayland_release(server);
 }
 
-static void tmbr_server_on_unmap(struct wl_listener *listener, TMBR_UNUSED void *payload)
+static void tmbr_server_on_new_xwayland_surface(struct wl_listener *listener, void *payload)
 {
-	struct tmbr_xdg_client *client = wl_container_of(listener, client, unmap);
-	if (client->desktop)
-		tmbr_desktop_remove_client(client->desktop, client);
+	struct tmbr_server *server = wl_container_of(listener, server, new_xwayland_surface);
+	struct wlr_xwayland_surface *surface = payload;
+
+	server->xwayland_surfaces++;
+	wl_event_source_timer_update(server->xwayland_idle, 0);
+
+	if (surface->override_redirect) {
+		struct tmbr_xwayland_unmanaged *u = tmbr_alloc(sizeof(*u), "Could not allocate unmanaged X11 surface");
+		u->server = server;
+		u->surface = surface;
+		tmbr_register(&surface->events.map, &u->map, tmbr_xwayland_unmanaged_on_map);
+		tmbr_register(&surface->events.unmap, &u->unmap, tmbr_xwayland_unmanaged_on_unmap);
+		tmbr_register(&surface->events.request_configure, &u->request_configure, tmbr_xwayland_unmanaged_on_request_configure);
+		tmbr_register(&surface->events.destroy, &u->destroy, tmbr_xwayland_unmanaged_on_destroy);
+	} else {
+		struct tmbr_xdg_client *client = tmbr_alloc(sizeof(*client), "Could not allocate client");
+		client->server = server;
+		client->xsurface = surface;
+		tmbr_register(&surface->events.map, &client->map, tmbr_xwayland_client_on_map);
+		tmbr_register(&surface->events.unmap, &client->unmap, tmbr_xwayland_client_on_unmap);
+		tmbr_register(&surface->events.request_configure, &client->request_configure, tmbr_xwayland_client_on_request_configure);
+		tmbr_register(&surface->events.request_fullscreen, &client->request_fullscreen, tmbr_xwayland_client_on_request_fullscreen);
+		tmbr_register(&surface->events.set_title, &client->set_title, tmbr_xdg_client_on_set_title);
+		tmbr_register(&surface->events.set_class, &client->set_app_id, tmbr_xdg_client_on_set_app_id);
+		tmbr_register(&surface->events.destroy, &client->destroy, tmbr_xwayland_client_on_destroy);
+	}
 }
+#endif
 
-static void tmbr_server_on_new_surface(struct wl_listener *listener, void *payload)
+static void tmbr_xdg_decoration_on_request_mode(struct wl_listener *listener, TMBR_UNUSED void *payload)
 {
-	struct tmbr_server *server = wl_container_of(listener, server, new_surface);
-	struct wlr_xdg_surface *surface = payload;
+	struct tmbr_xdg_decoration *decoration = wl_container_of(listener, decoration, request_mode);
+	wlr_xdg_toplevel_decoration_v1_set_mode(decoration->decoration, WLR_XDG_TOPLEVEL_DECORATION_V1_MODE_SERVER_SIDE);
+}
 
-	if (surface->role == WLR_XDG_SURFACE_ROLE_TOPLEVEL) {
-		struct tmbr_xdg_client *client = tmbr_xdg_client_new(server, surface);
-		tmbr_register(&surface->events.map, &client->map, tmbr_server_on_map);
-		tmbr_register(&surface->events.unmap, &client->unmap, tmbr_server_on_unmap);
-		tmbr_register(&surface->toplevel->events.request_fullscreen, &client->request_fullscreen, tmbr_server_on_request_fullscreen);
-	}
+static void tmbr_xdg_decoration_on_destroy(struct wl_listener *listener, TMBR_UNUSED void *payload)
+{
+	struct tmbr_xdg_decoration *decoration = wl_container_of(listener, decoration, destroy);
+	tmbr_unregister(&decoration->request_mode, &decoration->destroy, NULL);
+	free(decoration);
+}
+
+static void tmbr_server_on_new_xdg_decoration(TMBR_UNUSED struct wl_listener *listener, void *payload)
+{
+	struct tmbr_xdg_decoration *decoration = tmbr_alloc(sizeof(*decoration), "Could not allocate XDG decoration");
+	decoration->decoration = payload;
+	tmbr_register(&decoration->decoration->events.request_mode, &decoration->request_mode, tmbr_xdg_decoration_on_request_mode);
+	tmbr_register(&decoration->decoration->events.destroy, &decoration->destroy, tmbr_xdg_decoration_on_destroy);
+	tmbr_xdg_decoration_on_request_mode(&decoration->request_mode, NULL);
 }
 
 static void tmbr_server_on_new_layer_shell_surface(struct wl_listener *listener, void *payload)
@@ -1260,6 +3279,7 @@ static void tmbr_cursor_on_axis(struct wl_listener *listener, void *payload)
 	struct tmbr_server *server = wl_container_of(listener, server, cursor_axis);
 	struct wlr_event_pointer_axis *event = payload;
 	wlr_idle_notify_activity(server->idle, server->seat);
+	tmbr_server_stamp_input(server, event->time_msec);
 	wlr_seat_pointer_notify_axis(server->seat, event->time_msec, event->orientation,
 				     event->delta, event->delta_discrete, event->source);
 }
@@ -1268,7 +3288,48 @@ static void tmbr_cursor_on_button(struct wl_listener *listener, void *payload)
 {
 	struct tmbr_server *server = wl_container_of(listener, server, cursor_button);
 	struct wlr_event_pointer_button *event = payload;
+	struct wlr_keyboard *keyboard;
+	struct tmbr_screen *screen;
+	struct tmbr_desktop *desktop;
+
 	wlr_idle_notify_activity(server->idle, server->seat);
+	tmbr_server_stamp_input(server, event->time_msec);
+
+	if ((server->drag.split || server->drag.client) && event->button == BTN_LEFT && event->state == WLR_BUTTON_RELEASED) {
+		server->drag.split = NULL;
+		server->drag.client = NULL;
+		wlr_xcursor_manager_set_cursor_image(server->xcursor, "left_ptr", server->cursor);
+		return;
+	}
+
+	if ((screen = tmbr_server_find_screen_at(server, server->cursor->x, server->cursor->y)) != NULL && screen->overview) {
+		if (event->state == WLR_BUTTON_PRESSED &&
+		    (desktop = tmbr_screen_find_overview_desktop_at(screen, server->cursor->x, server->cursor->y)) != NULL) {
+			tmbr_screen_focus_desktop(screen, desktop);
+			tmbr_screen_set_overview(screen, false);
+		}
+		return;
+	}
+
+	/* Dragging a split border resizes it, whereas dragging a client moves it within the tree */
+	if (screen && !screen->focus->fullscreen && event->button == BTN_LEFT && event->state == WLR_BUTTON_PRESSED &&
+	    (keyboard = wlr_seat_get_keyboard(server->seat)) != NULL &&
+	    (wlr_keyboard_get_modifiers(keyboard) & TMBR_DRAG_MODIFIER) == TMBR_DRAG_MODIFIER) {
+		if ((server->drag.split = tmbr_tree_find_split_at(screen->focus->clients, server->cursor->x, server->cursor->y)) != NULL) {
+			server->drag.desktop = screen->focus;
+			tmbr_tree_get_box(server->drag.split, &server->drag.box);
+			wlr_xcursor_manager_set_cursor_image(server->xcursor, server->drag.split->split == TMBR_SPLIT_VERTICAL ?
+							     "col-resize" : "row-resize", server->cursor);
+			return;
+		}
+		if ((server->drag.client = tmbr_screen_find_xdg_client_at(screen, server->cursor->x, server->cursor->y)) != NULL) {
+			server->drag.desktop = screen->focus;
+			wlr_seat_pointer_notify_clear_focus(server->seat);
+			wlr_xcursor_manager_set_cursor_image(server->xcursor, "fleur", server->cursor);
+			return;
+		}
+	}
+
 	wlr_seat_pointer_notify_button(server->seat, event->time_msec, event->button, event->state);
 }
 
@@ -1278,6 +3339,46 @@ static void tmbr_cursor_on_frame(struct wl_listener *listener, TMBR_UNUSED void
 	wlr_seat_pointer_notify_frame(server->seat);
 }
 
+static void tmbr_cursor_handle_drag(struct tmbr_server *server)
+{
+	struct tmbr_desktop *desktop = server->drag.desktop;
+	struct wlr_box *box = &server->drag.box;
+	double ratio;
+
+	if (server->drag.split->split == TMBR_SPLIT_VERTICAL)
+		ratio = (server->cursor->x - box->x) * 100.0 / box->width;
+	else
+		ratio = (server->cursor->y - box->y) * 100.0 / box->height;
+	server->drag.split->ratio = ratio < 1 ? 1 : ratio > 99 ? 99 : ratio;
+
+	/* Clients get reconfigured on the next frame, see tmbr_screen_on_frame */
+	desktop->resize_pending = true;
+	if (desktop->screen)
+		wlr_output_schedule_frame(desktop->screen->output);
+}
+
+static void tmbr_cursor_handle_move(struct tmbr_server *server)
+{
+	struct tmbr_desktop *desktop = server->drag.desktop;
+	struct tmbr_xdg_client *target;
+
+	/*
+	 * Client positions only get updated once the swapped layout has been
+	 * applied, so further swaps have to wait for that. Otherwise the
+	 * client would be swapped back as the cursor still hovers the target.
+	 */
+	if (!desktop->screen || desktop->screen->focus != desktop || desktop->resize_pending || tmbr_desktop_is_configuring(desktop) ||
+	    (target = tmbr_screen_find_xdg_client_at(desktop->screen, server->cursor->x, server->cursor->y)) == NULL ||
+	    target == server->drag.client)
+		return;
+
+	tmbr_tree_swap(server->drag.client->tree, target->tree);
+
+	/* Clients get reconfigured on the next frame, see tmbr_screen_on_frame */
+	desktop->resize_pending = true;
+	wlr_output_schedule_frame(desktop->screen->output);
+}
+
 static void tmbr_cursor_handle_motion(struct tmbr_server *server)
 {
 	struct tmbr_layer_client *layer_client = NULL;
@@ -1287,10 +3388,24 @@ static void tmbr_cursor_handle_motion(struct tmbr_server *server)
 	wlr_idle_notify_activity(server->idle, server->seat);
 	if (server->input_inhibit->active_client)
 		return;
+	if (server->drag.split) {
+		tmbr_cursor_handle_drag(server);
+		return;
+	}
+	if (server->drag.client) {
+		tmbr_cursor_handle_move(server);
+		return;
+	}
 
 	if ((screen = tmbr_server_find_screen_at(server, server->cursor->x, server->cursor->y)) == NULL)
 		return;
 	server->focussed_screen = screen;
+	if (screen->overview)
+		return;
+#if WLR_HAS_XWAYLAND
+	if (tmbr_xwayland_unmanaged_notify_pointer(server))
+		return;
+#endif
 
 	if ((layer_client = tmbr_screen_find_layer_client_at(screen, server->cursor->x, server->cursor->y)) != NULL)
 		tmbr_layer_client_notify_focus(layer_client);
@@ -1302,6 +3417,7 @@ static void tmbr_cursor_on_motion(struct wl_listener *listener, void *payload)
 {
 	struct tmbr_server *server = wl_container_of(listener, server, cursor_motion);
 	struct wlr_event_pointer_motion *event = payload;
+	tmbr_server_stamp_input(server, event->time_msec);
 	wlr_cursor_move(server->cursor, event->device, event->delta_x, event->delta_y);
 	tmbr_cursor_handle_motion(server);
 }
@@ -1310,6 +3426,7 @@ static void tmbr_cursor_on_motion_absolute(struct wl_listener *listener, void *p
 {
 	struct tmbr_server *server = wl_container_of(listener, server, cursor_motion_absolute);
 	struct wlr_event_pointer_motion_absolute *event = payload;
+	tmbr_server_stamp_input(server, event->time_msec);
 	wlr_cursor_warp_absolute(server->cursor, event->device, event->x, event->y);
 	tmbr_cursor_handle_motion(server);
 }
@@ -1325,17 +3442,18 @@ static void tmbr_cursor_on_touch_down(struct wl_listener *listener, void *payloa
 	double x, y, sx, sy;
 
 	wlr_idle_notify_activity(server->idle, server->seat);
+	tmbr_server_stamp_input(server, event->time_msec);
 	if (server->input_inhibit->active_client)
 		return;
 
 	wlr_cursor_absolute_to_layout_coords(server->cursor, event->device, event->x, event->y, &x, &y);
-	if ((screen = tmbr_server_find_screen_at(server, server->cursor->x, server->cursor->y)) == NULL)
+	if ((screen = tmbr_server_find_screen_at(server, server->cursor->x, server->cursor->y)) == NULL || screen->overview)
 		return;
 
 	if ((layer_client = tmbr_screen_find_layer_client_at(screen, x, y)) != NULL)
 		surface = wlr_layer_surface_v1_surface_at(layer_client->surface, x - layer_client->x, y - layer_client->y, &sx, &sy);
 	else if ((xdg_client = tmbr_screen_find_xdg_client_at(screen, x, y)) != NULL)
-		surface = wlr_xdg_surface_surface_at(xdg_client->surface, x - xdg_client->x, y - xdg_client->y, &sx, &sy);
+		surface = tmbr_xdg_client_surface_at(xdg_client, x - xdg_client->x, y - xdg_client->y, &sx, &sy);
 	if (surface)
 		wlr_seat_touch_notify_down(server->seat, surface, event->time_msec, event->touch_id, sx, sy);
 }
@@ -1376,8 +3494,10 @@ static void tmbr_server_on_idle(struct wl_listener *listener, TMBR_UNUSED void *
 	struct tmbr_server *server = wl_container_of(listener, server, seat_idle);
 	struct tmbr_screen *s;
 	wl_list_for_each(s, &server->screens, link) {
+		if (!s->output->enabled)
+			continue;
 		wlr_output_enable(s->output, false);
-		wlr_output_commit(s->output);
+		s->idle_disabled = wlr_output_commit(s->output);
 	}
 }
 
@@ -1386,11 +3506,35 @@ static void tmbr_server_on_resume(struct wl_listener *listener, TMBR_UNUSED void
 	struct tmbr_server *server = wl_container_of(listener, server, seat_resume);
 	struct tmbr_screen *s;
 	wl_list_for_each(s, &server->screens, link) {
+		if (!s->idle_disabled)
+			continue;
 		wlr_output_enable(s->output, true);
 		wlr_output_commit(s->output);
+		wlr_output_damage_add_whole(s->damage);
+		s->idle_disabled = false;
 	}
 }
 
+static void tmbr_server_on_output_power_set_mode(TMBR_UNUSED struct wl_listener *listener, void *payload)
+{
+	struct wlr_output_power_v1_set_mode_event *event = payload;
+	struct tmbr_screen *screen = event->output->data;
+
+	/*
+	 * Outputs disabled via output management have handed over their
+	 * desktops and need to be re-enabled the same way. Mirrors only
+	 * copy their source and thus may be powered on their own.
+	 */
+	if (!screen || screen->disabled)
+		return;
+	wlr_output_enable(event->output, event->mode == ZWLR_OUTPUT_POWER_V1_MODE_ON);
+	if (!wlr_output_commit(event->output))
+		return;
+	if (event->output->enabled)
+		wlr_output_damage_add_whole(screen->damage);
+	screen->idle_disabled = false;
+}
+
 static void tmbr_server_on_destroy_idle_inhibitor(struct wl_listener *listener, TMBR_UNUSED void *payload)
 {
 	struct tmbr_server *server = wl_container_of(listener, server, idle_inhibitor_destroy);
@@ -1470,7 +3614,7 @@ static void tmbr_cmd_client_resize(TMBR_UNUSED struct wl_client *client, struct
 		break;
 	}
 
-	if ((i < 0 && i >= tree->ratio) || (i > 0 && i + tree->ratio >= 100))
+	if (tree->ratio + i < 1 || tree->ratio + i > 99)
 		tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "invalid ratio");
 	tree->ratio += i;
 	tmbr_desktop_recalculate(focus->desktop);
@@ -1553,6 +3697,12 @@ static void tmbr_cmd_desktop_swap(TMBR_UNUSED struct wl_client *client, struct w
 	tmbr_desktop_swap(server->focussed_screen->focus, sibling);
 }
 
+static void tmbr_cmd_desktop_overview(TMBR_UNUSED struct wl_client *client, struct wl_resource *resource)
+{
+	struct tmbr_server *server = wl_resource_get_user_data(resource);
+	tmbr_screen_set_overview(server->focussed_screen, !server->focussed_screen->overview);
+}
+
 static void tmbr_cmd_screen_focus(TMBR_UNUSED struct wl_client *client, struct wl_resource *resource, uint32_t selection)
 {
 	struct tmbr_server *server = wl_resource_get_user_data(resource);
@@ -1565,30 +3715,171 @@ static void tmbr_cmd_screen_focus(TMBR_UNUSED struct wl_client *client, struct w
 static void tmbr_cmd_screen_mode(TMBR_UNUSED struct wl_client *client, struct wl_resource *resource, const char *screen, int32_t height, int32_t width, int32_t refresh)
 {
 	struct tmbr_server *server = wl_resource_get_user_data(resource);
+	struct wlr_output_configuration_v1 *cfg;
 	struct wlr_output_mode *mode;
 	struct tmbr_screen *s;
+	bool ok;
 
 	if ((s = tmbr_server_find_output(server, screen)) == NULL)
 		tmbr_return_error(resource, TMBR_CTRL_ERROR_SCREEN_NOT_FOUND, "screen not found");
-	wl_list_for_each(mode, &s->output->modes, link) {
-		if (width != mode->width || height != mode->height || refresh != mode->refresh)
-			continue;
-		wlr_output_set_mode(s->output, mode);
-		return;
-	}
+	if ((mode = tmbr_screen_find_mode(s, width, height, refresh)) == NULL)
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "invalid mode");
+
+	if ((cfg = wlr_output_configuration_v1_create()) == NULL)
+		die("Could not allocate output configuration");
+	tmbr_server_add_output_configuration(server, cfg, s->output)->state.mode = mode;
+	ok = tmbr_server_apply_output_configuration(server, cfg, false);
+	wlr_output_configuration_v1_destroy(cfg);
 
-	tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "invalid mode");
+	if (!ok)
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "invalid mode");
 }
 
 static void tmbr_cmd_screen_scale(TMBR_UNUSED struct wl_client *client, struct wl_resource *resource, const char *screen, uint32_t scale)
 {
 	struct tmbr_server *server = wl_resource_get_user_data(resource);
+	struct wlr_output_configuration_v1 *cfg;
 	struct tmbr_screen *s;
+	bool ok;
+
 	if (scale <= 0 || scale >= 10000)
 		tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "invalid scale");
 	if ((s = tmbr_server_find_output(server, screen)) == NULL)
 		tmbr_return_error(resource, TMBR_CTRL_ERROR_SCREEN_NOT_FOUND, "screen not found");
-	wlr_output_set_scale(s->output, scale / 100.0);
+
+	if ((cfg = wlr_output_configuration_v1_create()) == NULL)
+		die("Could not allocate output configuration");
+	tmbr_server_add_output_configuration(server, cfg, s->output)->state.scale = scale / 100.0;
+	ok = tmbr_server_apply_output_configuration(server, cfg, false);
+	wlr_output_configuration_v1_destroy(cfg);
+
+	if (!ok)
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "invalid scale");
+}
+
+static void tmbr_cmd_screen_configure(TMBR_UNUSED struct wl_client *client, struct wl_resource *resource, const char *screen,
+				      uint32_t enabled, int32_t width, int32_t height, int32_t refresh, uint32_t scale, int32_t x, int32_t y)
+{
+	struct tmbr_server *server = wl_resource_get_user_data(resource);
+	struct wlr_output_configuration_head_v1 *head;
+	struct wlr_output_mode *mode = NULL;
+	struct tmbr_screen *s;
+
+	if ((s = tmbr_server_find_output(server, screen)) == NULL)
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_SCREEN_NOT_FOUND, "screen not found");
+	if (enabled && (scale <= 0 || scale >= 10000))
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "invalid scale");
+	if (enabled && (mode = tmbr_screen_find_mode(s, width, height, refresh)) == NULL)
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "invalid mode");
+
+	if (server->ctrl_configuration_owner != resource) {
+		if (server->ctrl_configuration)
+			wlr_output_configuration_v1_destroy(server->ctrl_configuration);
+		if ((server->ctrl_configuration = wlr_output_configuration_v1_create()) == NULL)
+			die("Could not allocate output configuration");
+		server->ctrl_configuration_owner = resource;
+	}
+
+	head = tmbr_server_add_output_configuration(server, server->ctrl_configuration, s->output);
+	head->state.enabled = enabled;
+	if (enabled) {
+		head->state.mode = mode;
+		head->state.scale = scale / 100.0;
+		head->state.x = x;
+		head->state.y = y;
+	}
+}
+
+static void tmbr_cmd_screen_apply(TMBR_UNUSED struct wl_client *client, struct wl_resource *resource)
+{
+	struct tmbr_server *server = wl_resource_get_user_data(resource);
+	bool ok;
+
+	if (server->ctrl_configuration_owner != resource)
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "no pending configuration");
+
+	ok = tmbr_server_apply_output_configuration(server, server->ctrl_configuration, false);
+	wlr_output_configuration_v1_destroy(server->ctrl_configuration);
+	server->ctrl_configuration = NULL;
+	server->ctrl_configuration_owner = NULL;
+
+	if (!ok)
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "invalid configuration");
+}
+
+static void tmbr_cmd_screen_new(TMBR_UNUSED struct wl_client *client, struct wl_resource *resource, int32_t width, int32_t height, int32_t refresh)
+{
+	struct tmbr_server *server = wl_resource_get_user_data(resource);
+	struct wlr_output *output;
+
+	if (width <= 0 || height <= 0 || refresh < 0)
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "invalid mode");
+	if (!wlr_backend_is_multi(server->backend))
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "backend does not support headless screens");
+
+	if (!server->headless) {
+#if WLR_VERSION_MAJOR == 0 && WLR_VERSION_MINOR < 14
+		server->headless = wlr_headless_backend_create_with_renderer(server->display, wlr_backend_get_renderer(server->backend));
+#else
+		server->headless = wlr_headless_backend_create(server->display);
+#endif
+		if (!server->headless || !wlr_multi_backend_add(server->backend, server->headless) || !wlr_backend_start(server->headless))
+			die("Could not create headless backend");
+	}
+
+	/*
+	 * The screen itself gets created by the backend's new_output event,
+	 * which also commits the requested refresh rate before the screen
+	 * starts rendering its first frame.
+	 */
+	server->headless_refresh = refresh;
+	output = wlr_headless_add_output(server->headless, width, height);
+	server->headless_refresh = 0;
+	if (!output)
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "invalid mode");
+	if (!output->data) {
+		wlr_output_destroy(output);
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "could not set mode");
+	}
+}
+
+static void tmbr_cmd_screen_kill(TMBR_UNUSED struct wl_client *client, struct wl_resource *resource, const char *screen)
+{
+	struct tmbr_server *server = wl_resource_get_user_data(resource);
+	struct tmbr_screen *s;
+
+	if ((s = tmbr_server_find_output(server, screen)) == NULL || !wlr_output_is_headless(s->output))
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_SCREEN_NOT_FOUND, "screen not found");
+	if (tmbr_screen_find_sibling(s, TMBR_CTRL_SELECTION_NEXT) == NULL)
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "cannot kill last screen");
+
+	/* Killing a screen is deliberate, so its desktops move to the sibling right away instead of being parked */
+	tmbr_screen_set_disabled(s, true);
+	wlr_output_destroy(s->output);
+}
+
+static void tmbr_cmd_screen_mirror(TMBR_UNUSED struct wl_client *client, struct wl_resource *resource, const char *screen, const char *source)
+{
+	struct tmbr_server *server = wl_resource_get_user_data(resource);
+	struct tmbr_screen *s, *src = NULL, *m;
+
+	if ((s = tmbr_server_find_output(server, screen)) == NULL ||
+	    (*source && (src = tmbr_server_find_output(server, source)) == NULL))
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_SCREEN_NOT_FOUND, "screen not found");
+	if (src && (src == s || src->mirror || src->disabled))
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "invalid mirror source");
+	wl_list_for_each(m, &server->screens, link)
+		if (src && m->mirror == s)
+			tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "screen is being mirrored");
+	if (src && !src->readback.enabled) {
+		struct wlr_dmabuf_attributes attribs;
+		if (wlr_output_export_dmabuf(src->output, &attribs))
+			wlr_dmabuf_attributes_finish(&attribs);
+		else if (!tmbr_screen_can_read_back(src))
+			tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "mirroring not supported by screen");
+	}
+
+	tmbr_screen_set_mirror(s, src);
 }
 
 static void tmbr_cmd_tree_rotate(TMBR_UNUSED struct wl_client *client, struct wl_resource *resource)
@@ -1610,6 +3901,63 @@ static void tmbr_cmd_tree_rotate(TMBR_UNUSED struct wl_client *client, struct wl
 	tmbr_desktop_recalculate(focus->desktop);
 }
 
+static void tmbr_cmd_tree_export(TMBR_UNUSED struct wl_client *client, struct wl_resource *resource, int fd)
+{
+	struct tmbr_server *server = wl_resource_get_user_data(resource);
+	struct tmbr_desktop *desktop = server->focussed_screen->focus;
+	int index = 0;
+	FILE *f;
+
+	if ((f = fdopen(fd, "w")) == NULL)
+		return;
+	if (desktop->clients)
+		tmbr_tree_export(desktop->clients, f, &index);
+	fputc('\n', f);
+	fclose(f);
+}
+
+static void tmbr_cmd_tree_import(TMBR_UNUSED struct wl_client *client, struct wl_resource *resource, const char *layout)
+{
+	struct tmbr_server *server = wl_resource_get_user_data(resource);
+	struct tmbr_desktop *desktop = server->focussed_screen->focus;
+	struct tmbr_xdg_client **clients;
+	struct tmbr_tree *tree;
+	size_t j, nclients = 0;
+
+	if (!desktop->clients)
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_CLIENT_NOT_FOUND, "client not found");
+
+	tmbr_tree_for_each(desktop->clients, t)
+		nclients++;
+	clients = tmbr_alloc(nclients * sizeof(*clients), "Could not allocate clients");
+	nclients = 0;
+	tmbr_tree_for_each(desktop->clients, t)
+		clients[nclients++] = t->client;
+
+	tree = tmbr_tree_import(&layout, clients, nclients, NULL);
+	for (j = 0; tree && j < nclients; j++)
+		if (clients[j])
+			break;
+	free(clients);
+
+	if (!tree || *layout || j != nclients) {
+		tmbr_tree_free(tree);
+		tmbr_return_error(resource, TMBR_CTRL_ERROR_INVALID_PARAM, "invalid layout");
+	}
+
+	/* The complete tree gets swapped at once so that clients are only configured once */
+	if (server->drag.desktop == desktop) {
+		server->drag.split = NULL;
+		server->drag.client = NULL;
+	}
+	tmbr_tree_free(desktop->clients);
+	desktop->clients = tree;
+	tmbr_tree_for_each(desktop->clients, t)
+		t->client->tree = t;
+	tmbr_desktop_set_fullscreen(desktop, false);
+	tmbr_desktop_recalculate(desktop);
+}
+
 static void tmbr_cmd_state_query(TMBR_UNUSED struct wl_client *client, TMBR_UNUSED struct wl_resource *resource, int fd)
 {
 	struct tmbr_server *server = wl_resource_get_user_data(resource);
@@ -1629,6 +3977,21 @@ static void tmbr_cmd_state_query(TMBR_UNUSED struct wl_client *client, TMBR_UNUS
 		fprintf(f, "- name: %s\n", s->output->name);
 		fprintf(f, "  geom: {x: %u, y: %u, width: %u, height: %u}\n", (int)x, (int)y, s->box.width, s->box.height);
 		fprintf(f, "  selected: %s\n", s == server->focussed_screen ? "true" : "false");
+		if (s->mirror)
+			fprintf(f, "  mirror: %s\n", s->mirror->output->name);
+		if (tmbr_screen_wants_async(s))
+			fprintf(f, "  presentation: {requested: async, scanout: %s}\n", s->scanout ? "true" : "false");
+		if (s->nlatencies) {
+			size_t n = s->nlatencies < ARRAY_SIZE(s->latencies) ? s->nlatencies : ARRAY_SIZE(s->latencies);
+			uint32_t latencies[ARRAY_SIZE(s->latencies)];
+
+			memcpy(latencies, s->latencies, n * sizeof(*latencies));
+			qsort(latencies, n, sizeof(*latencies), tmbr_compare_latencies);
+			fprintf(f, "  latency: {samples: %zu, p50: %.3f, p90: %.3f, p99: %.3f, max: %.3f}\n", n,
+				latencies[(n - 1) * 50 / 100] / 1000.0, latencies[(n - 1) * 90 / 100] / 1000.0,
+				latencies[(n - 1) * 99 / 100] / 1000.0, latencies[n - 1] / 1000.0);
+		}
+		fprintf(f, "  render: {frames: %lu, damage_reallocations: %lu}\n", s->frames, s->damage_reallocations);
 		fprintf(f, "  modes:\n");
 		wl_list_for_each(mode, &s->output->modes, link)
 			fprintf(f, "  - %dx%d@%d\n", mode->width, mode->height, mode->refresh);
@@ -1639,13 +4002,20 @@ static void tmbr_cmd_state_query(TMBR_UNUSED struct wl_client *client, TMBR_UNUS
 			fprintf(f, "    clients:\n");
 			tmbr_tree_for_each(d->clients, tree) {
 				struct tmbr_xdg_client *c = tree->client;
-				fprintf(f, "    - title: %s\n", c->surface->toplevel->title);
+				fprintf(f, "    - title: %s\n", tmbr_xdg_client_get_title(c));
 				fprintf(f, "      geom: {x: %u, y: %u, width: %u, height: %u}\n", c->x, c->y, c->w, c->h);
 				fprintf(f, "      selected: %s\n", c == d->focus ? "true" : "false");
 			}
 		}
 	}
 
+	fprintf(f, "startup:\n");
+	for (size_t i = 0; i < server->startup_phases; i++) {
+		struct timespec *start = &server->startup[0].time, *t = &server->startup[i].time;
+		fprintf(f, "- {phase: %s, msec: %.3f}\n", server->startup[i].phase,
+			(t->tv_sec - start->tv_sec) * 1000.0 + (t->tv_nsec - start->tv_nsec) / 1000000.0);
+	}
+
 	fclose(f);
 }
 
@@ -1687,6 +4057,92 @@ static int tmbr_server_on_term(TMBR_UNUSED int signal, void *payload)
 	return 0;
 }
 
+static void tmbr_server_on_unbind(struct wl_resource *resource)
+{
+	struct tmbr_server *server = wl_resource_get_user_data(resource);
+	if (server->ctrl_configuration_owner == resource) {
+		wlr_output_configuration_v1_destroy(server->ctrl_configuration);
+		server->ctrl_configuration = NULL;
+		server->ctrl_configuration_owner = NULL;
+	}
+}
+
+static void tmbr_server_harden_latency(void)
+{
+	struct sched_param param = { .sched_priority = TMBR_LATENCY_RTPRIO };
+	volatile char stack[TMBR_LATENCY_STACK_PREFAULT];
+	struct rlimit limit;
+	size_t i;
+
+	/*
+	 * SCHED_RESET_ON_FORK makes sure that neither the clients spawned
+	 * by us nor Xwayland inherit the elevated scheduling parameters.
+	 */
+	if (getrlimit(RLIMIT_RTPRIO, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY &&
+	    limit.rlim_cur > 0 && limit.rlim_cur < TMBR_LATENCY_RTPRIO)
+		param.sched_priority = limit.rlim_cur;
+	if (sched_setscheduler(0, SCHED_FIFO|SCHED_RESET_ON_FORK, &param) == 0) {
+		wlr_log(WLR_INFO, "Using realtime scheduling with priority %d", param.sched_priority);
+	} else {
+		param.sched_priority = 0;
+		if (sched_setscheduler(0, SCHED_OTHER|SCHED_RESET_ON_FORK, &param) < 0 ||
+		    setpriority(PRIO_PROCESS, 0, TMBR_LATENCY_NICE) < 0)
+			wlr_log(WLR_ERROR, "Could not elevate scheduling priority: %s", strerror(errno));
+		else
+			wlr_log(WLR_INFO, "Realtime scheduling not permitted, using nice value %d", TMBR_LATENCY_NICE);
+	}
+
+	/*
+	 * Pre-fault the stack so that it gets locked alongside everything
+	 * that is mapped already. MCL_FUTURE is deliberately not used: it
+	 * would also pin every buffer and cursor theme allocated later on
+	 * and quickly exhaust RLIMIT_MEMLOCK, after which allocations start
+	 * failing. Memory mapped after startup thus may still be paged out.
+	 */
+	for (i = 0; i < sizeof(stack); i += 4096)
+		stack[i] = 0;
+	if (mlockall(MCL_CURRENT) < 0)
+		wlr_log(WLR_ERROR, "Could not lock memory: %s", strerror(errno));
+}
+
+static int tmbr_cgroup_open(const char *cgroup, const char *name, unsigned weight)
+{
+	char path[PATH_MAX], buf[16];
+	int fd, len;
+
+	snprintf(path, sizeof(path), "%s/%s", cgroup, name);
+	if (mkdir(path, 0755) < 0 && errno != EEXIST)
+		return -1;
+
+	snprintf(path, sizeof(path), "%s/%s/cpu.weight", cgroup, name);
+	if ((fd = open(path, O_WRONLY|O_CLOEXEC)) < 0)
+		return -1;
+	len = snprintf(buf, sizeof(buf), "%u", weight);
+	if (write(fd, buf, len) < 0) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	snprintf(path, sizeof(path), "%s/%s/cgroup.procs", cgroup, name);
+	return open(path, O_WRONLY|O_CLOEXEC);
+}
+
+static void tmbr_server_setup_cgroup(struct tmbr_server *server, const char *cgroup)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/cgroup.subtree_control", cgroup);
+	if ((fd = open(path, O_WRONLY|O_CLOEXEC)) < 0 || write(fd, "+cpu", 4) < 0)
+		die("Could not enable CPU controller for cgroup '%s': %s", cgroup, strerror(errno));
+	close(fd);
+
+	if ((server->cgroup_procs[false] = tmbr_cgroup_open(cgroup, "background", TMBR_CLIENT_BACKGROUND_WEIGHT)) < 0 ||
+	    (server->cgroup_procs[true] = tmbr_cgroup_open(cgroup, "focus", TMBR_CLIENT_FOCUS_WEIGHT)) < 0)
+		die("Could not set up client cgroups in '%s': %s", cgroup, strerror(errno));
+}
+
 static void tmbr_server_on_bind(struct wl_client *client, void *payload, uint32_t version, uint32_t id)
 {
 	static const struct tmbr_ctrl_interface impl = {
@@ -1701,10 +4157,18 @@ static void tmbr_server_on_bind(struct wl_client *client, void *payload, uint32_
 		.desktop_kill = tmbr_cmd_desktop_kill,
 		.desktop_new = tmbr_cmd_desktop_new,
 		.desktop_swap = tmbr_cmd_desktop_swap,
+		.desktop_overview = tmbr_cmd_desktop_overview,
 		.screen_focus = tmbr_cmd_screen_focus,
 		.screen_mode = tmbr_cmd_screen_mode,
 		.screen_scale = tmbr_cmd_screen_scale,
+		.screen_configure = tmbr_cmd_screen_configure,
+		.screen_apply = tmbr_cmd_screen_apply,
+		.screen_new = tmbr_cmd_screen_new,
+		.screen_kill = tmbr_cmd_screen_kill,
+		.screen_mirror = tmbr_cmd_screen_mirror,
 		.tree_rotate = tmbr_cmd_tree_rotate,
+		.tree_export = tmbr_cmd_tree_export,
+		.tree_import = tmbr_cmd_tree_import,
 		.state_query = tmbr_cmd_state_query,
 		.state_quit = tmbr_cmd_state_quit,
 		.binding_add = tmbr_cmd_binding_add,
@@ -1715,25 +4179,140 @@ static void tmbr_server_on_bind(struct wl_client *client, void *payload, uint32_
 		wl_client_post_no_memory(client);
 		return;
 	}
+	wl_resource_set_implementation(resource, &impl, payload, tmbr_server_on_unbind);
+}
+
+static void tmbr_tearing_control_detach(struct tmbr_tearing_control *tc)
+{
+	if (!tc->surface)
+		return;
+	tmbr_unregister(&tc->surface_commit, &tc->surface_destroy, NULL);
+	wl_list_remove(&tc->link);
+	tc->surface = NULL;
+}
+
+static void tmbr_tearing_control_on_surface_commit(struct wl_listener *listener, TMBR_UNUSED void *payload)
+{
+	struct tmbr_tearing_control *tc = wl_container_of(listener, tc, surface_commit);
+	tc->current = tc->pending;
+}
+
+static void tmbr_tearing_control_on_surface_destroy(struct wl_listener *listener, TMBR_UNUSED void *payload)
+{
+	struct tmbr_tearing_control *tc = wl_container_of(listener, tc, surface_destroy);
+	tmbr_tearing_control_detach(tc);
+}
+
+static void tmbr_tearing_control_on_unbind(struct wl_resource *resource)
+{
+	struct tmbr_tearing_control *tc = wl_resource_get_user_data(resource);
+	tmbr_tearing_control_detach(tc);
+	free(tc);
+}
+
+static void tmbr_tearing_control_set_presentation_hint(TMBR_UNUSED struct wl_client *client, struct wl_resource *resource, uint32_t hint)
+{
+	struct tmbr_tearing_control *tc = wl_resource_get_user_data(resource);
+
+	/* The protocol does not define an error of its own for invalid hints */
+	if (hint != WP_TEARING_CONTROL_V1_PRESENTATION_HINT_VSYNC && hint != WP_TEARING_CONTROL_V1_PRESENTATION_HINT_ASYNC)
+		tmbr_return_error(resource, WL_DISPLAY_ERROR_INVALID_METHOD, "Invalid presentation hint");
+	tc->pending = hint;
+}
+
+static void tmbr_tearing_control_destroy(TMBR_UNUSED struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void tmbr_tearing_control_manager_get_tearing_control(struct wl_client *client, struct wl_resource *resource,
+							     uint32_t id, struct wl_resource *surface_resource)
+{
+	static const struct wp_tearing_control_v1_interface impl = {
+		.set_presentation_hint = tmbr_tearing_control_set_presentation_hint,
+		.destroy = tmbr_tearing_control_destroy,
+	};
+	struct tmbr_server *server = wl_resource_get_user_data(resource);
+	struct wlr_surface *surface = wlr_surface_from_resource(surface_resource);
+	struct tmbr_tearing_control *tc;
+
+	wl_list_for_each(tc, &server->tearing_controls, link)
+		if (tc->surface == surface)
+			tmbr_return_error(resource, WP_TEARING_CONTROL_MANAGER_V1_ERROR_TEARING_CONTROL_EXISTS,
+					  "Surface already has a tearing control object");
+
+	tc = tmbr_alloc(sizeof(*tc), "Could not allocate tearing control");
+	if ((tc->resource = wl_resource_create(client, &wp_tearing_control_v1_interface, wl_resource_get_version(resource), id)) == NULL) {
+		free(tc);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(tc->resource, &impl, tc, tmbr_tearing_control_on_unbind);
+
+	tc->surface = surface;
+	tc->pending = tc->current = WP_TEARING_CONTROL_V1_PRESENTATION_HINT_VSYNC;
+	tmbr_register(&surface->events.commit, &tc->surface_commit, tmbr_tearing_control_on_surface_commit);
+	tmbr_register(&surface->events.destroy, &tc->surface_destroy, tmbr_tearing_control_on_surface_destroy);
+	wl_list_insert(&server->tearing_controls, &tc->link);
+}
+
+static void tmbr_tearing_control_manager_destroy(TMBR_UNUSED struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void tmbr_server_on_bind_tearing_control(struct wl_client *client, void *payload, uint32_t version, uint32_t id)
+{
+	static const struct wp_tearing_control_manager_v1_interface impl = {
+		.destroy = tmbr_tearing_control_manager_destroy,
+		.get_tearing_control = tmbr_tearing_control_manager_get_tearing_control,
+	};
+	struct wl_resource *resource;
+
+	if ((resource = wl_resource_create(client, &wp_tearing_control_manager_v1_interface, version, id)) == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
 	wl_resource_set_implementation(resource, &impl, payload, NULL);
 }
 
-int tmbr_wm(void)
+int tmbr_wm(int argc, char *argv[])
 {
-	struct tmbr_server server = { 0 };
+	struct tmbr_server server = { .cgroup_procs = { -1, -1 } };
+	struct tmbr_xcursor_load *load, *tmp;
 	const char *socket;
-	char *cfg;
+	char *cfg, *cgroup;
+
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--profile"))
+			server.startup_profile = true;
+		else if (!strcmp(argv[i], "--realtime"))
+			server.realtime = true;
+		else
+			die("Unknown option '%s'", argv[i]);
+	}
+	tmbr_server_mark_startup(&server, "start");
+
+	if ((cgroup = getenv("TMBR_CLIENT_CGROUP")) != NULL)
+		tmbr_server_setup_cgroup(&server, cgroup);
 
 	wl_list_init(&server.bindings);
 	wl_list_init(&server.screens);
+	wl_list_init(&server.xcursor_loads);
+	wl_list_init(&server.parked_screens);
+	wl_list_init(&server.processes);
+	wl_list_init(&server.xwayland_unmanaged);
+	wl_list_init(&server.tearing_controls);
 	if ((server.display = wl_display_create()) == NULL)
 		die("Could not create display");
 	if ((server.backend = wlr_backend_autocreate(server.display)) == NULL)
 		die("Could not create backend");
 	wlr_renderer_init_wl_display(wlr_backend_get_renderer(server.backend), server.display);
+	tmbr_server_mark_startup(&server, "backend");
 
 	if (wl_global_create(server.display, &tmbr_ctrl_interface, 1, &server, tmbr_server_on_bind) == NULL ||
-	    wlr_compositor_create(server.display, wlr_backend_get_renderer(server.backend)) == NULL ||
+	    wl_global_create(server.display, &wp_tearing_control_manager_v1_interface, 1, &server, tmbr_server_on_bind_tearing_control) == NULL ||
+	    (server.compositor = wlr_compositor_create(server.display, wlr_backend_get_renderer(server.backend))) == NULL ||
 	    wlr_data_device_manager_create(server.display) == NULL ||
 	    wlr_export_dmabuf_manager_v1_create(server.display) == NULL ||
 	    wlr_gamma_control_manager_v1_create(server.display) == NULL ||
@@ -1741,9 +4320,10 @@ int tmbr_wm(void)
 	    wlr_gtk_primary_selection_device_manager_create(server.display) == NULL ||
 #endif
 	    wlr_primary_selection_v1_device_manager_create(server.display) == NULL ||
-	    wlr_xdg_decoration_manager_v1_create(server.display) == NULL ||
+	    (server.xdg_decoration = wlr_xdg_decoration_manager_v1_create(server.display)) == NULL ||
 	    (server.decoration = wlr_server_decoration_manager_create(server.display)) == NULL ||
 	    (server.cursor = wlr_cursor_create()) == NULL ||
+	    (server.foreign_toplevel = wlr_foreign_toplevel_manager_v1_create(server.display)) == NULL ||
 	    (server.seat = wlr_seat_create(server.display, "seat0")) == NULL ||
 	    (server.idle = wlr_idle_create(server.display)) == NULL ||
 	    (server.idle_inhibit = wlr_idle_inhibit_v1_create(server.display)) == NULL ||
@@ -1751,6 +4331,8 @@ int tmbr_wm(void)
 	    (server.input_inhibit = wlr_input_inhibit_manager_create(server.display)) == NULL ||
 	    (server.layer_shell = wlr_layer_shell_v1_create(server.display)) == NULL ||
 	    (server.output_layout = wlr_output_layout_create()) == NULL ||
+	    (server.output_manager = wlr_output_manager_v1_create(server.display)) == NULL ||
+	    (server.output_power = wlr_output_power_manager_v1_create(server.display)) == NULL ||
 	    (server.xcursor = wlr_xcursor_manager_create(getenv("XCURSOR_THEME"), 24)) == NULL ||
 	    (server.xdg_shell = wlr_xdg_shell_create(server.display)) == NULL ||
 	    wlr_xdg_output_manager_v1_create(server.display, server.output_layout) == NULL)
@@ -1758,12 +4340,28 @@ int tmbr_wm(void)
 
 	wlr_server_decoration_manager_set_default_mode(server.decoration, WLR_SERVER_DECORATION_MANAGER_MODE_SERVER);
 	wlr_cursor_attach_output_layout(server.cursor, server.output_layout);
-	wlr_xcursor_manager_load(server.xcursor, 1);
+	tmbr_xcursor_load(&server, 1);
+	tmbr_server_mark_startup(&server, "globals");
+
+#if WLR_HAS_XWAYLAND
+	/* The X server only gets spawned when the first X11 client connects */
+	if ((server.xwayland = wlr_xwayland_create(server.display, server.compositor, true)) == NULL)
+		die("Could not create Xwayland server");
+	server.xwayland_idle = wl_event_loop_add_timer(wl_display_get_event_loop(server.display), tmbr_xwayland_on_idle, &server);
+	wlr_xwayland_set_seat(server.xwayland, server.seat);
+	tmbr_register(&server.xwayland->events.new_surface, &server.new_xwayland_surface, tmbr_server_on_new_xwayland_surface);
+	setenv("DISPLAY", server.xwayland->display_name, 1);
+#endif
 
 	tmbr_register(&server.backend->events.new_input, &server.new_input, tmbr_server_on_new_input);
 	tmbr_register(&server.backend->events.new_output, &server.new_output, tmbr_server_on_new_output);
 	tmbr_register(&server.xdg_shell->events.new_surface, &server.new_surface, tmbr_server_on_new_surface);
 	tmbr_register(&server.layer_shell->events.new_surface, &server.new_layer_shell_surface, tmbr_server_on_new_layer_shell_surface);
+	tmbr_register(&server.output_layout->events.change, &server.output_layout_change, tmbr_server_on_output_layout_change);
+	tmbr_register(&server.output_manager->events.apply, &server.output_manager_apply, tmbr_server_on_output_manager_apply);
+	tmbr_register(&server.output_manager->events.test, &server.output_manager_test, tmbr_server_on_output_manager_test);
+	tmbr_register(&server.output_power->events.set_mode, &server.output_power_set_mode, tmbr_server_on_output_power_set_mode);
+	tmbr_register(&server.xdg_decoration->events.new_toplevel_decoration, &server.new_xdg_decoration, tmbr_server_on_new_xdg_decoration);
 	tmbr_register(&server.seat->events.request_set_cursor, &server.request_set_cursor, tmbr_server_on_request_set_cursor);
 	tmbr_register(&server.seat->events.request_set_selection, &server.request_set_selection, tmbr_server_on_request_set_selection);
 	tmbr_register(&server.seat->events.request_set_primary_selection, &server.request_set_primary_selection, tmbr_server_on_request_set_primary_selection);
@@ -1786,6 +4384,10 @@ int tmbr_wm(void)
 
 	if (!wlr_backend_start(server.backend))
 		die("Could not start backend");
+	tmbr_server_mark_startup(&server, "backend start");
+
+	if (server.realtime)
+		tmbr_server_harden_latency();
 
 	if ((cfg = getenv("TMBR_CONFIG_PATH")) == NULL)
 		cfg = TMBR_CONFIG_PATH;
@@ -1793,8 +4395,23 @@ int tmbr_wm(void)
 		tmbr_spawn(cfg, (char * const[]){ cfg, NULL });
 	else if (errno != ENOENT)
 		die("Could not execute config file: %s", strerror(errno));
+	tmbr_server_mark_startup(&server, "config");
 
 	wl_display_run(server.display);
+	wl_list_for_each_safe(load, tmp, &server.xcursor_loads, link) {
+		pthread_join(load->thread, NULL);
+		if (load->theme)
+			wlr_xcursor_theme_destroy(load->theme);
+		tmbr_xcursor_load_free(load);
+	}
+#if WLR_HAS_XWAYLAND
+	wlr_xwayland_destroy(server.xwayland);
+	/* The X server is gone now, so a pending client check cannot block anymore */
+	if (server.xwayland_check) {
+		pthread_join(server.xwayland_check->thread, NULL);
+		tmbr_xwayland_check_free(server.xwayland_check);
+	}
+#endif
 	wl_display_destroy_clients(server.display);
 	wl_display_destroy(server.display);
 	return 0;